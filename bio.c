@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -9,49 +9,289 @@
 // * To get a buffer for a particular disk block, call bread.
 // * After changing buffer data, call bwrite to write it to disk.
 // * When done with the buffer, call brelse.
+// * To start reading a block that will be wanted soon,
+//     call breadahead; it does not wait for the disk.
+// * To have several of your own requests in flight, start
+//     them with breadasync or bwriteasync, and call bwait
+//     before touching each buffer's data or releasing it.
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
 //
-// The implementation uses two state flags internally:
+// The implementation uses these state flags internally:
 // * B_VALID: the buffer data has been read from the disk.
 // * B_DIRTY: the buffer data has been modified
 //     and needs to be written to disk.
+// * B_FREE: the buffer holds no block and is on the free list.
+// * B_ASYNC: the buffer is being read ahead; the disk driver
+//     releases it when the read completes.
 
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "bstat.h"
 
-struct {
+// Buffers are hashed by (dev, blockno) into NBUCKET buckets, each
+// with its own lock and its own list, most recently used first, so
+// that lookups of different blocks do not contend. Recycling a
+// buffer takes the least recently used one from the bucket under
+// a clock hand, which moves on to the next bucket each time, so
+// a miss usually looks at just one bucket. evictlock serializes
+// recycling so that it never needs to hold two bucket locks.
+//
+// Besides the NBUF static buffers, the cache grows from whole
+// kalloc() pages up to 1/BCACHEFRAC of physical memory, and
+// gives idle pages back through bshrink() when kalloc() runs dry.
+#define NBUCKET 251
+#define BPERPAGE (PGSIZE / sizeof(struct buf))
+#define NBPAGE ((PHYSTOP/PGSIZE) / BCACHEFRAC)
+#define BSHRINK 16             // Most pages bshrink() frees at a time
+
+struct bucket {
   struct spinlock lock;
-  struct buf buf[NBUF];
+  struct buf *head;            // Most recently used
+  struct buf *tail;            // Least recently used
+  uint hits;
+  uint ahead;
+};
 
-  // Linked list of all buffers, through prev/next.
-  // head.next is most recently used.
-  struct buf head;
+struct {
+  struct spinlock evictlock;
+  struct buf buf[NBUF];
+  char *page[NBPAGE];          // Pages holding more buffers
+  int npage;
+  struct bucket free;          // Unused buffers, under evictlock
+  int waiting;                 // bget() is waiting for a buffer
+  int hand;                    // Next bucket bevict() takes from
+  uint misses;
+  uint shrunk;
+  struct bucket bucket[NBUCKET];
 } bcache;
 
+static struct bucket*
+bhash(uint dev, uint blockno)
+{
+  return &bcache.bucket[(dev*31 + blockno) % NBUCKET];
+}
+
+// Insert b at the front of bk's list.  Caller holds bk->lock.
+static void
+bpush(struct bucket *bk, struct buf *b)
+{
+  b->prev = 0;
+  b->next = bk->head;
+  if(bk->head)
+    bk->head->prev = b;
+  else
+    bk->tail = b;
+  bk->head = b;
+}
+
+static void
+bunlink(struct bucket *bk, struct buf *b)
+{
+  if(b->prev)
+    b->prev->next = b->next;
+  else
+    bk->head = b->next;
+  if(b->next)
+    b->next->prev = b->prev;
+  else
+    bk->tail = b->prev;
+}
+
+// Put an unused buffer on the free list.  Caller holds evictlock.
+static void
+bfree(struct buf *b)
+{
+  b->flags = B_FREE;
+  b->refcnt = 0;
+  bpush(&bcache.free, b);
+}
+
 void
 binit(void)
 {
   struct buf *b;
+  struct bucket *bk;
 
-  initlock(&bcache.lock, "bcache");
+  initlock(&bcache.evictlock, "bcache");
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++)
+    initlock(&bk->lock, "bcache.bucket");
 
 //PAGEBREAK!
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
   for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
     initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    bfree(b);
+  }
+}
+
+// Add a page of buffers to the free list.
+// Returns 0 if the cache is at full size or memory is short.
+// Caller holds evictlock.
+static int
+bgrow(void)
+{
+  struct buf *b;
+  char *p;
+
+  if(bcache.npage >= NBPAGE || (p = kalloc()) == 0)
+    return 0;
+  memset(p, 0, PGSIZE);
+  bcache.page[bcache.npage++] = p;
+  for(b = (struct buf*)p; b < (struct buf*)p + BPERPAGE; b++){
+    initsleeplock(&b->lock, "buffer");
+    bfree(b);
+  }
+  return 1;
+}
+
+// Grow the cache to its full size.  Called once physical
+// memory is available, after kinit2().
+void
+binit2(void)
+{
+  acquire(&bcache.evictlock);
+  while(bgrow())
+    ;
+  release(&bcache.evictlock);
+}
+
+// Take every buffer in page p out of the cache, if none of them
+// is in use.  Caller holds evictlock.
+static int
+bdetach(char *p)
+{
+  struct buf *b, *b1;
+  struct bucket *bk;
+
+  for(b = (struct buf*)p; b < (struct buf*)p + BPERPAGE; b++){
+    if(b->flags & B_FREE){
+      bunlink(&bcache.free, b);
+      continue;
+    }
+    bk = bhash(b->dev, b->blockno);
+    acquire(&bk->lock);
+    if(b->refcnt != 0 || (b->flags & B_DIRTY)){
+      release(&bk->lock);
+      // Busy; the ones already taken out lose their
+      // contents and go back as free buffers.
+      for(b1 = (struct buf*)p; b1 < b; b1++)
+        bfree(b1);
+      return 0;
+    }
+    bunlink(bk, b);
+    release(&bk->lock);
+  }
+  return 1;
+}
+
+// Give idle buffer pages back to kalloc().
+// Returns the number of pages freed.
+int
+bshrink(void)
+{
+  int i, n;
+  char *p;
+
+  // bgrow() calls kalloc() with evictlock held.
+  pushcli();
+  i = holding(&bcache.evictlock);
+  popcli();
+  if(i)
+    return 0;
+
+  n = 0;
+  acquire(&bcache.evictlock);
+  for(i = bcache.npage-1; i >= 0 && n < BSHRINK; i--){
+    p = bcache.page[i];
+    if(!bdetach(p))
+      continue;
+    bcache.page[i] = bcache.page[--bcache.npage];
+    kfree(p);
+    n++;
+  }
+  bcache.shrunk += n;
+  release(&bcache.evictlock);
+  return n;
+}
+
+// Look for block on device dev in bucket bk.
+// Caller holds bk->lock.
+static struct buf*
+bfind(struct bucket *bk, uint dev, uint blockno)
+{
+  struct buf *b;
+
+  for(b = bk->head; b; b = b->next)
+    if(b->dev == dev && b->blockno == blockno)
+      return b;
+  return 0;
+}
+
+// Like bfind, but take a reference to the buffer found.
+static struct buf*
+blookup(struct bucket *bk, uint dev, uint blockno)
+{
+  struct buf *b;
+
+  if((b = bfind(bk, dev, blockno)) != 0)
+    b->refcnt++;
+  return b;
+}
+
+// Take an unused buffer off the free list, or else the least
+// recently used unreferenced buffer of the first bucket from
+// the clock hand on that has one, and return it with refcnt 1.
+// Caller holds evictlock.
+static struct buf*
+bevict(void)
+{
+  struct bucket *bk;
+  struct buf *b;
+  int i;
+
+  for(;;){
+    if((b = bcache.free.head) != 0){
+      bunlink(&bcache.free, b);
+      b->refcnt = 1;
+      return b;
+    }
+
+    for(i = 0; i < NBUCKET; i++){
+      bk = &bcache.bucket[bcache.hand];
+      bcache.hand = (bcache.hand + 1) % NBUCKET;
+      acquire(&bk->lock);
+      // Even if refcnt==0, B_DIRTY indicates a buffer is in use
+      // because log.c has modified it but not yet committed it.
+      for(b = bk->tail; b; b = b->prev){
+        if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0){
+          bunlink(bk, b);
+          b->refcnt = 1;
+          release(&bk->lock);
+          return b;
+        }
+      }
+      release(&bk->lock);
+    }
+
+    if(bgrow())
+      continue;
+
+    // Every buffer is in use.  Rather than give up, wait for
+    // brelse(); go round once more after announcing it, so that
+    // a buffer released while the hand went round is not missed.
+    if(!bcache.waiting){
+      bcache.waiting = 1;
+      continue;
+    }
+    sleep(&bcache, &bcache.evictlock);
   }
 }
 
@@ -61,35 +301,64 @@ binit(void)
 static struct buf*
 bget(uint dev, uint blockno)
 {
+  struct bucket *bk = bhash(dev, blockno);
   struct buf *b;
 
-  acquire(&bcache.lock);
-
   // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
-    }
+  acquire(&bk->lock);
+  b = blookup(bk, dev, blockno);
+  if(b)
+    bk->hits++;
+  release(&bk->lock);
+  if(b){
+    acquiresleep(&b->lock);
+    return b;
   }
 
   // Not cached; recycle an unused buffer.
-  // Even if refcnt==0, B_DIRTY indicates a buffer is in use
-  // because log.c has modified it but not yet committed it.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->flags = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
-    }
+  acquire(&bcache.evictlock);
+  // Someone else may have cached it while we waited.
+  acquire(&bk->lock);
+  b = blookup(bk, dev, blockno);
+  release(&bk->lock);
+  if(b == 0){
+    bcache.misses++;
+    b = bevict();
+    b->dev = dev;
+    b->blockno = blockno;
+    b->flags = 0;
+    acquire(&bk->lock);
+    bpush(bk, b);
+    release(&bk->lock);
   }
-  panic("bget: no buffers");
+  release(&bcache.evictlock);
+  acquiresleep(&b->lock);
+  return b;
+}
+
+// Copy the cache's counters into st.  st may be in user
+// memory, where writing can fault, so gather the counters
+// under the locks that protect them and write st after.
+void
+bstat(struct bcachestat *st)
+{
+  struct bcachestat copy;
+  struct bucket *bk;
+
+  copy.hits = 0;
+  copy.ahead = 0;
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++){
+    acquire(&bk->lock);
+    copy.hits += bk->hits;
+    copy.ahead += bk->ahead;
+    release(&bk->lock);
+  }
+  acquire(&bcache.evictlock);
+  copy.misses = bcache.misses;
+  copy.nbuf = NBUF + bcache.npage * BPERPAGE;
+  copy.shrunk = bcache.shrunk;
+  release(&bcache.evictlock);
+  *st = copy;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -105,6 +374,48 @@ bread(uint dev, uint blockno)
   return b;
 }
 
+// Start reading the indicated block into the cache without
+// waiting for it.  The buffer belongs to the disk driver until
+// the read completes, so a bread() of the block in the meantime
+// sleeps on the buffer lock rather than issuing a second read.
+void
+breadahead(uint dev, uint blockno)
+{
+  struct bucket *bk = bhash(dev, blockno);
+  struct buf *b;
+
+  // Cached or already on its way.
+  acquire(&bk->lock);
+  b = bfind(bk, dev, blockno);
+  release(&bk->lock);
+  if(b)
+    return;
+
+  b = bget(dev, blockno);
+  if(b->flags & B_VALID){
+    brelse(b);
+    return;
+  }
+  acquire(&bk->lock);
+  bk->ahead++;
+  release(&bk->lock);
+  b->flags |= B_ASYNC;
+  idesubmit(b);
+}
+
+// Like bread, but only start reading the block from disk.
+// Call bwait before looking at the data.
+struct buf*
+breadasync(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno);
+  if((b->flags & B_VALID) == 0)
+    idesubmit(b);
+  return b;
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -115,30 +426,55 @@ bwrite(struct buf *b)
   iderw(b);
 }
 
+// Start writing b's contents to disk.  Must be locked.
+// Call bwait before changing b or releasing it.
+void
+bwriteasync(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("bwriteasync");
+  b->flags |= B_DIRTY;
+  idesubmit(b);
+}
+
+// Wait for a breadasync or bwriteasync of b to finish.
+void
+bwait(struct buf *b)
+{
+  if((b->flags & (B_VALID|B_DIRTY)) != B_VALID)
+    idecomplete(b);
+}
+
 // Release a locked buffer.
-// Move to the head of the MRU list.
+// Move to the head of its bucket's MRU list.
 void
 brelse(struct buf *b)
 {
+  struct bucket *bk;
+
   if(!holdingsleep(&b->lock))
     panic("brelse");
 
   releasesleep(&b->lock);
 
-  acquire(&bcache.lock);
+  bk = bhash(b->dev, b->blockno);
+  acquire(&bk->lock);
   b->refcnt--;
   if (b->refcnt == 0) {
     // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    bunlink(bk, b);
+    bpush(bk, b);
+  }
+  release(&bk->lock);
+
+  if(bcache.waiting){
+    acquire(&bcache.evictlock);
+    bcache.waiting = 0;
+    wakeup(&bcache);
+    release(&bcache.evictlock);
   }
-  
-  release(&bcache.lock);
 }
+
 //PAGEBREAK!
 // Blank page.
 
@@ -0,0 +1,8 @@
+// Buffer cache counters returned by bcachestat().
+struct bcachestat {
+  uint nbuf;       // Buffers in the cache
+  uint hits;       // bread()s found in the cache
+  uint misses;     // bread()s that had to recycle a buffer
+  uint shrunk;     // Pages given back under memory pressure
+  uint ahead;      // Blocks breadahead() started reading
+};
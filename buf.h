@@ -4,11 +4,14 @@ struct buf {
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
+  struct buf *prev; // LRU list of its hash bucket
   struct buf *next;
   struct buf *qnext; // disk queue
+  uint qtime;        // ticks when queued, for the disk deadline
   uchar data[BSIZE];
 };
 #define B_VALID 0x2  // buffer has been read from disk
 #define B_DIRTY 0x4  // buffer needs to be written to disk
+#define B_FREE  0x8  // buffer holds no block; on the cache's free list
+#define B_ASYNC 0x10 // read-ahead; the disk driver releases the buffer
 
@@ -1,9 +1,13 @@
+struct bcachestat;
+struct diskstat;
 struct buf;
 struct context;
+struct cpustat;
 struct file;
 struct inode;
 struct pipe;
 struct proc;
+struct procstat;
 struct rtcdate;
 struct spinlock;
 struct sleeplock;
@@ -12,9 +16,16 @@ struct superblock;
 
 // bio.c
 void            binit(void);
+void            binit2(void);
+int             bshrink(void);
+void            bstat(struct bcachestat*);
 struct buf*     bread(uint, uint);
+void            breadahead(uint, uint);
+struct buf*     breadasync(uint, uint);
+void            bwait(struct buf*);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+void            bwriteasync(struct buf*);
 
 // console.c
 void            consoleinit(void);
@@ -36,6 +47,7 @@ int             filewrite(struct file*, char*, int n);
 
 // fs.c
 void            readsb(int dev, struct superblock *sb);
+void            dcremove(struct inode*, char*, uint);
 int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
 struct inode*   ialloc(uint, short);
@@ -57,6 +69,9 @@ int             writei(struct inode*, char*, uint, uint);
 void            ideinit(void);
 void            ideintr(void);
 void            iderw(struct buf*);
+void            idesubmit(struct buf*);
+void            idecomplete(struct buf*);
+void            idestat(struct diskstat*);
 
 // ioapic.c
 void            ioapicenable(int irq, int cpu);
@@ -68,6 +83,8 @@ char*           kalloc(void);
 void            kfree(char*);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
+void            kref(char*);
+int             krefcount(char*);
 
 // kbd.c
 void            kbdintr(void);
@@ -78,6 +95,7 @@ int             lapicid(void);
 extern volatile uint*    lapic;
 void            lapiceoi(void);
 void            lapicinit(void);
+void            lapicipi(uchar, int);
 void            lapicstartap(uchar, uint);
 void            microdelay(int);
 
@@ -86,6 +104,9 @@ void            initlog(int dev);
 void            log_write(struct buf*);
 void            begin_op();
 void            end_op();
+void            begin_opn(int);
+void            end_opn(int);
+int             logopmax(void);
 
 // mp.c
 extern int      ismp;
@@ -106,6 +127,8 @@ int             pipewrite(struct pipe*, char*, int);
 int             cpuid(void);
 void            exit(void);
 int             fork(void);
+int             getprocstats(struct procstat*, int);
+int             getcpustats(struct cpustat*, int);
 int             growproc(int);
 int             kill(int, int);
 struct cpu*     mycpu(void);
@@ -114,6 +137,8 @@ void            pinit(void);
 void            procdump(void);
 void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
+void            schedboost(void);
+int             schedtick(void);
 void            setproc(struct proc*);
 void            sleep(void*, struct spinlock*);
 void            userinit(void);
@@ -155,6 +180,7 @@ char*           strncpy(char*, const char*, int);
 // syscall.c
 int             argint(int, int*);
 int             argptr(int, char**, int);
+int             argwptr(int, char**, int);
 int             argstr(int, char**);
 int             fetchint(uint, int*);
 int             fetchstr(uint, char**);
@@ -185,6 +211,9 @@ void            freevm(pde_t*);
 void            inituvm(pde_t*, char*, uint);
 int             loaduvm(pde_t*, char*, struct inode*, uint, uint);
 pde_t*          copyuvm(pde_t*, uint);
+int             cowfault(pde_t*, uint);
+int             lazyfault(pde_t*, uint, uint);
+int             uvmtouch(pde_t*, uint, uint, uint, int);
 void            switchuvm(struct proc*);
 void            switchkvm(void);
 int             copyout(pde_t*, uint, void*, uint);
@@ -0,0 +1,10 @@
+// Disk queue counters returned by diskstat().
+struct diskstat {
+  uint nreq;       // Requests sent to the disk
+  uint ncmd;       // Disk commands; fewer when requests are merged
+  uint nseek;      // Requests not for the block after the last one
+  uint seekdist;   // Blocks the head moved for those requests
+  uint depthsum;   // Requests already queued, summed at each submit
+  uint maxdepth;   // Most requests queued at once
+  uint expired;    // Reads sent early because they hit the deadline
+};
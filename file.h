@@ -14,15 +14,26 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *prev; // icache bucket list, most recently used first
+  struct inode *next;
+  uint lastuse;       // ticks when ref last fell to 0, for reuse
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
+  uint nextbn;        // block a sequential readi() would start at
+  uint raend;         // blocks before this have been read ahead
+  uint runbn;         // bmap() found file blocks runbn..runbn+runlen-1
+  uint runaddr;       // at disk blocks runaddr..runaddr+runlen-1
+  uint runlen;
+  uint rsv;           // writei() set aside disk blocks rsv..rsv+nrsv-1
+  uint nrsv;          // for the blocks it is adding to the file
+  uint dirfree;       // directory has no free dirent before this offset
 
   short type;         // copy of disk inode
   short major;
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint addrs[NDIRECT+2];
 };
 
 // table mapping major device number to
@@ -23,6 +23,8 @@
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 static void itrunc(struct inode*);
+static void dcinit(void);
+static void dcpurge(struct inode*);
 // there should be one superblock per disk device, but we run with
 // only one device
 struct superblock sb; 
@@ -51,30 +53,124 @@ bzero(int dev, int bno)
 }
 
 // Blocks.
+//
+// The allocator works from an in-memory copy of the free bit
+// map, read by bmapinit(), so that finding a free block takes
+// no disk reads and looks at 32 blocks at a time.  Searches are
+// next-fit: they start where the last allocation ended, which
+// both skips the full start of the disk and lays out blocks
+// allocated one after another next to each other.  As with sb,
+// there is one map, for the one disk device.
+// The on-disk bitmap is still updated, through the log, on each
+// allocation and free.
 
-// Allocate a zeroed disk block.
-static uint
-balloc(uint dev)
+struct {
+  struct spinlock lock;
+  uint map[(FSSIZE+31)/32];  // bit set if block in use
+  uint cursor;               // where the next search starts
+} fmap;
+
+// Read the free bit map into fmap.  Blocks past the end
+// of the file system are marked in use.
+static void
+bmapinit(int dev)
 {
-  int b, bi, m;
   struct buf *bp;
+  uint b, n;
 
-  bp = 0;
+  if(sb.size > FSSIZE)
+    panic("bmapinit: file system too big");
+  initlock(&fmap.lock, "fmap");
   for(b = 0; b < sb.size; b += BPB){
     bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
+    n = min(BSIZE, sizeof(fmap.map) - b/8);
+    memmove((char*)fmap.map + b/8, bp->data, n);
+    brelse(bp);
+  }
+  for(b = sb.size; b < sizeof(fmap.map)*8; b++)
+    fmap.map[b/32] |= 1 << (b%32);
+  fmap.cursor = 0;
+}
+
+// Find up to n free blocks in a row, at least one, starting the
+// search at fmap.cursor; mark them in use in fmap and return
+// the first.  Sets *got to how many were found.
+static uint
+fmapfind(uint n, uint *got)
+{
+  uint w, b, i, nw, len;
+
+  nw = NELEM(fmap.map);
+  acquire(&fmap.lock);
+  w = fmap.cursor / 32;
+  b = fmap.cursor;
+  for(i = 0; i <= nw; i++){
+    if(fmap.map[w] != ~0){
+      for(; b < (w+1)*32; b++)
+        if((fmap.map[w] & (1 << (b%32))) == 0)
+          goto found;
+    }
+    w = (w + 1) % nw;
+    b = w*32;
+  }
+  release(&fmap.lock);
+  panic("balloc: out of blocks");
+
+found:
+  for(len = 0; len < n && b + len < nw*32; len++){
+    if((b+len) % 32 == 0 && n - len >= 32 && fmap.map[(b+len)/32] == 0){
+      fmap.map[(b+len)/32] = ~0;
+      len += 31;
+      continue;
+    }
+    if(fmap.map[(b+len)/32] & (1 << ((b+len)%32)))
+      break;
+    fmap.map[(b+len)/32] |= 1 << ((b+len)%32);
+  }
+  fmap.cursor = (b + len) % (nw*32);
+  release(&fmap.lock);
+  *got = len;
+  return b;
+}
+
+// Allocate up to n zeroed disk blocks in a row, at least one.
+// Returns the first and sets *got to how many were allocated.
+static uint
+ballocn(uint dev, uint n, uint *got)
+{
+  uint b, bi, m, first;
+  struct buf *bp;
+
+  first = fmapfind(n, got);
+  bp = 0;
+  for(b = first; b < first + *got; b++){
+    if(bp == 0 || b % BPB == 0){
+      if(bp){
         log_write(bp);
         brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
       }
+      bp = bread(dev, BBLOCK(b, sb));
     }
-    brelse(bp);
+    bi = b % BPB;
+    m = 1 << (bi % 8);
+    if(bp->data[bi/8] & m)
+      panic("balloc: block in use");
+    bp->data[bi/8] |= m;  // Mark block in use.
   }
-  panic("balloc: out of blocks");
+  log_write(bp);
+  brelse(bp);
+  for(b = first; b < first + *got; b++)
+    bzero(dev, b);
+  return first;
+}
+
+// Allocate a zeroed disk block.
+static uint
+balloc(uint dev)
+{
+  uint got;
+
+  return ballocn(dev, 1, &got);
 }
 
 // Free a disk block.
@@ -93,6 +189,10 @@ bfree(int dev, uint b)
   bp->data[bi/8] &= ~m;
   log_write(bp);
   brelse(bp);
+
+  acquire(&fmap.lock);
+  fmap.map[b/32] &= ~(1 << (b%32));
+  release(&fmap.lock);
 }
 
 // Inodes.
@@ -131,7 +231,9 @@ bfree(int dev, uint b)
 //   cache entry is only correct when ip->valid is 1.
 //   ilock() reads the inode from
 //   the disk and sets ip->valid, while iput() clears
-//   ip->valid if ip->ref has fallen to zero.
+//   ip->valid when it frees the inode.  An entry whose ref
+//   has fallen to zero stays cached, valid, until iget()
+//   needs the slot for another inode.
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
@@ -155,28 +257,141 @@ bfree(int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
-// The icache.lock spin-lock protects the allocation of icache
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold icache.lock while using any of those fields.
+// Like the buffer cache, the icache hashes entries by (dev,
+// inum) into buckets, each with its own spin-lock and its own
+// list, most recently used first.  A bucket's lock protects the
+// ref, prev, next and lastuse fields of the inodes in it; since
+// dev and inum decide the bucket, they only change while the
+// entry is in no bucket.  Reusing an entry has to look at every
+// bucket; icache.evictlock serializes that path, and only its
+// holder adds entries to buckets.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
+#define NIBUCKET 61
 
-struct {
+struct ibucket {
   struct spinlock lock;
+  struct inode *head;          // Most recently used
+  struct inode *tail;          // Least recently used
+};
+
+struct {
+  struct spinlock evictlock;
   struct inode inode[NINODE];
+  struct ibucket free;         // Entries never used, under evictlock
+  struct ibucket bucket[NIBUCKET];
 } icache;
 
+static struct ibucket*
+ihash(uint dev, uint inum)
+{
+  return &icache.bucket[(dev*31 + inum) % NIBUCKET];
+}
+
+// Insert ip at the front of bk's list.  Caller holds bk->lock.
+static void
+ipush(struct ibucket *bk, struct inode *ip)
+{
+  ip->prev = 0;
+  ip->next = bk->head;
+  if(bk->head)
+    bk->head->prev = ip;
+  else
+    bk->tail = ip;
+  bk->head = ip;
+}
+
+static void
+iunlink(struct ibucket *bk, struct inode *ip)
+{
+  if(ip->prev)
+    ip->prev->next = ip->next;
+  else
+    bk->head = ip->next;
+  if(ip->next)
+    ip->next->prev = ip->prev;
+  else
+    bk->tail = ip->prev;
+}
+
+// Which inodes are free, so that ialloc() need not read the
+// inode blocks to find one.  Like fmap for blocks, imap is
+// read at boot, and searched next-fit a word at a time.
+struct {
+  struct spinlock lock;
+  uint map[(NINODES+31)/32];  // bit set if inode allocated
+  uint cursor;                // where the next search starts
+} imap;
+
+// Fill in imap from the inode blocks.  Inode 0 and those
+// past sb.ninodes are never handed out.
+static void
+imapinit(int dev)
+{
+  struct buf *bp;
+  struct dinode *dip;
+  uint inum, b, i, end;
+
+  if(sb.ninodes > NINODES)
+    panic("imapinit: too many inodes");
+  initlock(&imap.lock, "imap");
+  end = IBLOCK(sb.ninodes - 1, sb) + 1;
+  for(b = sb.inodestart; b < end && b < sb.inodestart + NREADAHEAD; b++)
+    breadahead(dev, b);
+  for(inum = 0; inum < sb.ninodes; inum += IPB){
+    b = IBLOCK(inum, sb);
+    if(b + NREADAHEAD < end)
+      breadahead(dev, b + NREADAHEAD);
+    bp = bread(dev, b);
+    for(i = 0; i < IPB && inum + i < sb.ninodes; i++){
+      dip = (struct dinode*)bp->data + i;
+      if(dip->type != 0)
+        imap.map[(inum+i)/32] |= 1 << ((inum+i)%32);
+    }
+    brelse(bp);
+  }
+  imap.map[0] |= 1;
+  for(inum = sb.ninodes; inum < NELEM(imap.map)*32; inum++)
+    imap.map[inum/32] |= 1 << (inum%32);
+  imap.cursor = 0;
+}
+
+// Mark a free inode allocated in imap and return its number.
+static uint
+imapalloc(void)
+{
+  uint w, b, i, nw;
+
+  nw = NELEM(imap.map);
+  acquire(&imap.lock);
+  w = imap.cursor / 32;
+  for(i = 0; i <= nw; i++, w = (w + 1) % nw){
+    if(imap.map[w] == ~0)
+      continue;
+    for(b = 0; imap.map[w] & (1 << b); b++)
+      ;
+    imap.map[w] |= 1 << b;
+    imap.cursor = w*32 + b;
+    release(&imap.lock);
+    return w*32 + b;
+  }
+  release(&imap.lock);
+  panic("ialloc: no inodes");
+}
+
 void
 iinit(int dev)
 {
   int i = 0;
   
-  initlock(&icache.lock, "icache");
+  initlock(&icache.evictlock, "icache");
+  for(i = 0; i < NIBUCKET; i++)
+    initlock(&icache.bucket[i].lock, "icache.bucket");
   for(i = 0; i < NINODE; i++) {
     initsleeplock(&icache.inode[i].lock, "inode");
+    ipush(&icache.free, &icache.inode[i]);
   }
 
   readsb(dev, &sb);
@@ -184,6 +399,9 @@ iinit(int dev)
  inodestart %d bmap start %d\n", sb.size, sb.nblocks,
           sb.ninodes, sb.nlog, sb.logstart, sb.inodestart,
           sb.bmapstart);
+  bmapinit(dev);
+  imapinit(dev);
+  dcinit();
 }
 
 static struct inode* iget(uint dev, uint inum);
@@ -195,23 +413,20 @@ static struct inode* iget(uint dev, uint inum);
 struct inode*
 ialloc(uint dev, short type)
 {
-  int inum;
+  uint inum;
   struct buf *bp;
   struct dinode *dip;
 
-  for(inum = 1; inum < sb.ninodes; inum++){
-    bp = bread(dev, IBLOCK(inum, sb));
-    dip = (struct dinode*)bp->data + inum%IPB;
-    if(dip->type == 0){  // a free inode
-      memset(dip, 0, sizeof(*dip));
-      dip->type = type;
-      log_write(bp);   // mark it allocated on the disk
-      brelse(bp);
-      return iget(dev, inum);
-    }
-    brelse(bp);
-  }
-  panic("ialloc: no inodes");
+  inum = imapalloc();
+  bp = bread(dev, IBLOCK(inum, sb));
+  dip = (struct dinode*)bp->data + inum%IPB;
+  if(dip->type != 0)
+    panic("ialloc: inode in use");
+  memset(dip, 0, sizeof(*dip));
+  dip->type = type;
+  log_write(bp);   // mark it allocated on the disk
+  brelse(bp);
+  return iget(dev, inum);
 }
 
 // Copy a modified in-memory inode to disk.
@@ -236,39 +451,98 @@ iupdate(struct inode *ip)
   brelse(bp);
 }
 
-// Find the inode with number inum on device dev
-// and return the in-memory copy. Does not lock
-// the inode and does not read it from disk.
+// Look for inode inum on device dev in bucket bk and take a
+// reference to it.  Caller holds bk->lock.
 static struct inode*
-iget(uint dev, uint inum)
+ilookup(struct ibucket *bk, uint dev, uint inum)
 {
-  struct inode *ip, *empty;
-
-  acquire(&icache.lock);
+  struct inode *ip;
 
-  // Is the inode already cached?
-  empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
+  for(ip = bk->head; ip; ip = ip->next)
+    if(ip->dev == dev && ip->inum == inum){
       ip->ref++;
-      release(&icache.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
-  }
+  return 0;
+}
 
-  // Recycle an inode cache entry.
-  if(empty == 0)
-    panic("iget: no inodes");
+// Find the least recently used entry with no references, take it
+// off its list and return it.  Caller holds evictlock.
+static struct inode*
+ievict(void)
+{
+  struct ibucket *bk, *best;
+  struct inode *ip, *victim;
 
-  ip = empty;
-  ip->dev = dev;
-  ip->inum = inum;
-  ip->ref = 1;
-  ip->valid = 0;
-  release(&icache.lock);
+  for(;;){
+    if((ip = icache.free.head) != 0){
+      iunlink(&icache.free, ip);
+      return ip;
+    }
+
+    best = 0;
+    victim = 0;
+    for(bk = icache.bucket; bk < icache.bucket+NIBUCKET; bk++){
+      acquire(&bk->lock);
+      for(ip = bk->tail; ip; ip = ip->prev){
+        if(ip->ref == 0){
+          if(victim == 0 || ip->lastuse < victim->lastuse){
+            best = bk;
+            victim = ip;
+          }
+          break;
+        }
+      }
+      release(&bk->lock);
+    }
+    if(victim == 0)
+      panic("iget: no inodes");
+
+    // Only evictlock holders move entries between buckets, so
+    // victim is still in best; make sure nobody took it since.
+    acquire(&best->lock);
+    if(victim->ref == 0){
+      iunlink(best, victim);
+      release(&best->lock);
+      return victim;
+    }
+    release(&best->lock);
+  }
+}
 
+// Find the inode with number inum on device dev
+// and return the in-memory copy. Does not lock
+// the inode and does not read it from disk.
+static struct inode*
+iget(uint dev, uint inum)
+{
+  struct ibucket *bk = ihash(dev, inum);
+  struct inode *ip;
+
+  // Is the inode already cached?
+  acquire(&bk->lock);
+  ip = ilookup(bk, dev, inum);
+  release(&bk->lock);
+  if(ip)
+    return ip;
+
+  // Not cached.  Only evictlock holders add entries, so
+  // look once more while holding it before reusing one.
+  acquire(&icache.evictlock);
+  acquire(&bk->lock);
+  ip = ilookup(bk, dev, inum);
+  release(&bk->lock);
+  if(ip == 0){
+    ip = ievict();
+    ip->dev = dev;
+    ip->inum = inum;
+    ip->ref = 1;
+    ip->valid = 0;
+    acquire(&bk->lock);
+    ipush(bk, ip);
+    release(&bk->lock);
+  }
+  release(&icache.evictlock);
   return ip;
 }
 
@@ -277,9 +551,11 @@ iget(uint dev, uint inum)
 struct inode*
 idup(struct inode *ip)
 {
-  acquire(&icache.lock);
+  struct ibucket *bk = ihash(ip->dev, ip->inum);
+
+  acquire(&bk->lock);
   ip->ref++;
-  release(&icache.lock);
+  release(&bk->lock);
   return ip;
 }
 
@@ -306,6 +582,10 @@ ilock(struct inode *ip)
     ip->size = dip->size;
     memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
     brelse(bp);
+    ip->nextbn = 0;
+    ip->raend = 0;
+    ip->runlen = 0;
+    ip->dirfree = 0;
     ip->valid = 1;
     if(ip->type == 0)
       panic("ilock: no type");
@@ -332,24 +612,36 @@ iunlock(struct inode *ip)
 void
 iput(struct inode *ip)
 {
+  struct ibucket *bk = ihash(ip->dev, ip->inum);
+
   acquiresleep(&ip->lock);
   if(ip->valid && ip->nlink == 0){
-    acquire(&icache.lock);
+    acquire(&bk->lock);
     int r = ip->ref;
-    release(&icache.lock);
+    release(&bk->lock);
     if(r == 1){
       // inode has no links and no other references: truncate and free.
+      if(ip->type == T_DIR)
+        dcpurge(ip);
       itrunc(ip);
       ip->type = 0;
       iupdate(ip);
       ip->valid = 0;
+      acquire(&imap.lock);
+      imap.map[ip->inum/32] &= ~(1 << (ip->inum%32));
+      release(&imap.lock);
     }
   }
   releasesleep(&ip->lock);
 
-  acquire(&icache.lock);
+  acquire(&bk->lock);
   ip->ref--;
-  release(&icache.lock);
+  if(ip->ref == 0){
+    ip->lastuse = ticks;
+    iunlink(bk, ip);
+    ipush(bk, ip);
+  }
+  release(&bk->lock);
 }
 
 // Common idiom: unlock, then put.
@@ -366,19 +658,64 @@ iunlockput(struct inode *ip)
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// listed in block ip->addrs[NDIRECT], and the NDINDIRECT after
+// those in the indirect blocks listed in block ip->addrs[NDIRECT+1].
+
+#define NORUN ((uint)-1)
+
+// Allocate a data block for ip, from the blocks writei()
+// set aside for it if there are any left.
+static uint
+dalloc(struct inode *ip)
+{
+  if(ip->nrsv > 0){
+    ip->nrsv--;
+    return ip->rsv++;
+  }
+  return balloc(ip->dev);
+}
+
+// Return entry i of indirect block addr, allocating a block
+// for it if there is none.  Unless fbn is NORUN, the entry is
+// file block fbn; then remember how many of the entries after
+// it are adjacent on disk, so that bmap() can map the rest of
+// a sequential read without looking at the indirect block.
+static uint
+indirect(struct inode *ip, uint addr, uint i, uint fbn)
+{
+  uint n, *a;
+  struct buf *bp;
+
+  bp = bread(ip->dev, addr);
+  a = (uint*)bp->data;
+  if((addr = a[i]) == 0){
+    a[i] = addr = fbn == NORUN ? balloc(ip->dev) : dalloc(ip);
+    log_write(bp);
+  }
+  if(fbn != NORUN){
+    for(n = 1; i + n < NINDIRECT && a[i+n] == addr + n; n++)
+      ;
+    ip->runbn = fbn;
+    ip->runaddr = addr;
+    ip->runlen = n;
+  }
+  brelse(bp);
+  return addr;
+}
 
 // Return the disk block address of the nth block in inode ip.
 // If there is no such block, bmap allocates one.
 static uint
 bmap(struct inode *ip, uint bn)
 {
-  uint addr, *a;
-  struct buf *bp;
+  uint addr;
+
+  if(bn - ip->runbn < ip->runlen)
+    return ip->runaddr + (bn - ip->runbn);
 
   if(bn < NDIRECT){
     if((addr = ip->addrs[bn]) == 0)
-      ip->addrs[bn] = addr = balloc(ip->dev);
+      ip->addrs[bn] = addr = dalloc(ip);
     return addr;
   }
   bn -= NDIRECT;
@@ -387,17 +724,40 @@ bmap(struct inode *ip, uint bn)
     // Load indirect block, allocating if necessary.
     if((addr = ip->addrs[NDIRECT]) == 0)
       ip->addrs[NDIRECT] = addr = balloc(ip->dev);
+    return indirect(ip, addr, bn, NDIRECT + bn);
+  }
+  bn -= NINDIRECT;
+
+  if(bn < NDINDIRECT){
+    if((addr = ip->addrs[NDIRECT+1]) == 0)
+      ip->addrs[NDIRECT+1] = addr = balloc(ip->dev);
+    addr = indirect(ip, addr, bn / NINDIRECT, NORUN);
+    return indirect(ip, addr, bn % NINDIRECT, NDIRECT + NINDIRECT + bn);
+  }
+
+  panic("bmap: out of range");
+}
+
+// Free block addr of inode ip.  If depth > 0 it is an indirect
+// block, and the blocks it lists, depth-1 levels of indirection
+// deep, are freed first.
+static void
+ifree(struct inode *ip, uint addr, int depth)
+{
+  int j;
+  struct buf *bp;
+  uint *a;
+
+  if(depth > 0){
     bp = bread(ip->dev, addr);
     a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      a[bn] = addr = balloc(ip->dev);
-      log_write(bp);
+    for(j = 0; j < NINDIRECT; j++){
+      if(a[j])
+        ifree(ip, a[j], depth - 1);
     }
     brelse(bp);
-    return addr;
   }
-
-  panic("bmap: out of range");
+  bfree(ip->dev, addr);
 }
 
 // Truncate inode (discard contents).
@@ -408,28 +768,15 @@ bmap(struct inode *ip, uint bn)
 static void
 itrunc(struct inode *ip)
 {
-  int i, j;
-  struct buf *bp;
-  uint *a;
+  int i;
 
-  for(i = 0; i < NDIRECT; i++){
+  for(i = 0; i < NDIRECT+2; i++){
     if(ip->addrs[i]){
-      bfree(ip->dev, ip->addrs[i]);
+      ifree(ip, ip->addrs[i], i < NDIRECT ? 0 : i - NDIRECT + 1);
       ip->addrs[i] = 0;
     }
   }
-
-  if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
-    }
-    brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
-  }
+  ip->runlen = 0;
 
   ip->size = 0;
   iupdate(ip);
@@ -447,13 +794,33 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// Start reading the NREADAHEAD blocks of ip that follow
+// block bn, skipping those already read ahead, so that they
+// are on their way by the time the reader gets to them.
+// Caller must hold ip->lock but no buffers.
+static void
+readahead(struct inode *ip, uint bn)
+{
+  uint end;
+
+  end = (ip->size + BSIZE - 1) / BSIZE;
+  if(end > bn + 1 + NREADAHEAD)
+    end = bn + 1 + NREADAHEAD;
+  if(ip->raend < bn + 1)
+    ip->raend = bn + 1;
+  for(; ip->raend < end; ip->raend++)
+    breadahead(ip->dev, bmap(ip, ip->raend));
+}
+
 //PAGEBREAK!
 // Read data from inode.
+// A read that starts where the previous one ended is taken
+// to be sequential and reads ahead.
 // Caller must hold ip->lock.
 int
 readi(struct inode *ip, char *dst, uint off, uint n)
 {
-  uint tot, m;
+  uint tot, m, seq;
   struct buf *bp;
 
   if(ip->type == T_DEV){
@@ -467,12 +834,16 @@ readi(struct inode *ip, char *dst, uint off, uint n)
   if(off + n > ip->size)
     n = ip->size - off;
 
+  seq = off/BSIZE == ip->nextbn;
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
     m = min(n - tot, BSIZE - off%BSIZE);
     memmove(dst, bp->data + off%BSIZE, m);
     brelse(bp);
+    if(seq)
+      readahead(ip, off/BSIZE);
   }
+  ip->nextbn = off/BSIZE;
   return n;
 }
 
@@ -482,7 +853,7 @@ readi(struct inode *ip, char *dst, uint off, uint n)
 int
 writei(struct inode *ip, char *src, uint off, uint n)
 {
-  uint tot, m;
+  uint tot, m, nb;
   struct buf *bp;
 
   if(ip->type == T_DEV){
@@ -496,6 +867,14 @@ writei(struct inode *ip, char *src, uint off, uint n)
   if(off + n > MAXFILE*BSIZE)
     return -1;
 
+  // Allocate the blocks this write adds to the file in
+  // one run if there is room, so the file is sequential
+  // on disk.
+  nb = (off + n + BSIZE - 1)/BSIZE;
+  m = (ip->size + BSIZE - 1)/BSIZE;
+  if(nb > m + 1)
+    ip->rsv = ballocn(ip->dev, nb - m, &ip->nrsv);
+
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
     m = min(n - tot, BSIZE - off%BSIZE);
@@ -503,6 +882,8 @@ writei(struct inode *ip, char *src, uint off, uint n)
     log_write(bp);
     brelse(bp);
   }
+  if(ip->nrsv != 0)
+    panic("writei: blocks left over");
 
   if(n > 0 && off > ip->size){
     ip->size = off;
@@ -520,31 +901,246 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+// Directory name cache.
+//
+// The dcache remembers the results of dirlookup(), keyed by
+// (dev, directory inum, name): the entry's inum and offset, or
+// inum 0 for a name the directory does not hold.  Together with
+// the icache this lets namex() resolve names it has seen before
+// without reading directory blocks.  Entries are hashed into
+// NDBUCKET chains and reused least recently used first; the
+// spin-lock dcache.lock covers it all.
+//
+// A directory only changes while locked, and every change goes
+// through dirlink() or dcremove(), which update the cache; the
+// locked caller of dirlookup() therefore always sees the truth.
+// iput() purges a directory's entries when it frees the inode,
+// since the inum may come back as a different directory.
+#define NDCACHE 256
+#define NDBUCKET 61
+
+struct dentry {
+  uint dev;
+  uint dir;                    // directory inum; 0 if unused
+  char name[DIRSIZ];
+  uint inum;                   // 0 if name is not in dir
+  uint off;                    // offset of name's dirent in dir
+  struct dentry *hnext;        // hash chain
+  struct dentry *prev;         // LRU list, most recent first
+  struct dentry *next;
+};
+
+struct {
+  struct spinlock lock;
+  struct dentry dentry[NDCACHE];
+  struct dentry *head;         // Most recently used
+  struct dentry *tail;         // Least recently used
+  struct dentry *bucket[NDBUCKET];
+} dcache;
+
+static void
+dcinit(void)
+{
+  struct dentry *d;
+
+  initlock(&dcache.lock, "dcache");
+  for(d = dcache.dentry; d < dcache.dentry+NDCACHE; d++){
+    d->prev = dcache.tail;
+    if(dcache.tail)
+      dcache.tail->next = d;
+    else
+      dcache.head = d;
+    dcache.tail = d;
+  }
+}
+
+static struct dentry**
+dhash(uint dev, uint dir, char *name)
+{
+  uint h;
+  int i;
+
+  h = dev*31 + dir;
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = h*31 + (uchar)name[i];
+  return &dcache.bucket[h % NDBUCKET];
+}
+
+// Move d to the front (most recent) or the back of the LRU list.
+// Caller holds dcache.lock.
+static void
+dcmove(struct dentry *d, int front)
+{
+  if(d->prev)
+    d->prev->next = d->next;
+  else
+    dcache.head = d->next;
+  if(d->next)
+    d->next->prev = d->prev;
+  else
+    dcache.tail = d->prev;
+  if(front){
+    d->prev = 0;
+    d->next = dcache.head;
+    if(dcache.head)
+      dcache.head->prev = d;
+    else
+      dcache.tail = d;
+    dcache.head = d;
+  } else {
+    d->next = 0;
+    d->prev = dcache.tail;
+    if(dcache.tail)
+      dcache.tail->next = d;
+    else
+      dcache.head = d;
+    dcache.tail = d;
+  }
+}
+
+// Take d out of its hash chain and mark it unused.
+// Caller holds dcache.lock.
+static void
+dcdrop(struct dentry *d)
+{
+  struct dentry **pp;
+
+  for(pp = dhash(d->dev, d->dir, d->name); *pp; pp = &(*pp)->hnext){
+    if(*pp == d){
+      *pp = d->hnext;
+      break;
+    }
+  }
+  d->dir = 0;
+  dcmove(d, 0);
+}
+
+// Find the entry for name in directory dp.  Caller holds
+// dcache.lock.
+static struct dentry*
+dcfind(struct inode *dp, char *name)
+{
+  struct dentry *d;
+
+  for(d = *dhash(dp->dev, dp->inum, name); d; d = d->hnext)
+    if(d->dev == dp->dev && d->dir == dp->inum && namecmp(d->name, name) == 0)
+      return d;
+  return 0;
+}
+
+// Record that name in directory dp is inum at offset off,
+// or with inum 0, that dp has no such name.
+static void
+dcset(struct inode *dp, char *name, uint inum, uint off)
+{
+  struct dentry *d, **bk;
+
+  acquire(&dcache.lock);
+  if((d = dcfind(dp, name)) == 0){
+    d = dcache.tail;
+    if(d->dir)
+      dcdrop(d);
+    d->dev = dp->dev;
+    d->dir = dp->inum;
+    strncpy(d->name, name, DIRSIZ);
+    bk = dhash(d->dev, d->dir, d->name);
+    d->hnext = *bk;
+    *bk = d;
+  }
+  d->inum = inum;
+  d->off = off;
+  dcmove(d, 1);
+  release(&dcache.lock);
+}
+
+// Called by sys_unlink() after it has cleared name's dirent,
+// at offset off in the locked directory dp.
+void
+dcremove(struct inode *dp, char *name, uint off)
+{
+  dcset(dp, name, 0, 0);
+  if(off < dp->dirfree)
+    dp->dirfree = off;
+}
+
+// Forget every name in directory dp, which is being freed.
+static void
+dcpurge(struct inode *dp)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  for(d = dcache.dentry; d < dcache.dentry+NDCACHE; d++)
+    if(d->dir == dp->inum && d->dev == dp->dev)
+      dcdrop(d);
+  release(&dcache.lock);
+}
+
+// Scan directory dp from byte offset off a block at a time,
+// looking at the dirents in place in the buffer cache.  If name
+// is found, return its inum and set *poff to its offset.  With
+// name 0, return 0 and set *poff to the offset of the first free
+// dirent, or dp->size if there is none.
+static uint
+dirscan(struct inode *dp, char *name, uint off, uint *poff)
+{
+  uint end, inum;
+  struct buf *bp;
+  struct dirent *de;
+
+  for(; off < dp->size; off = end){
+    end = min(dp->size, (off/BSIZE + 1) * BSIZE);
+    bp = bread(dp->dev, bmap(dp, off/BSIZE));
+    de = (struct dirent*)(bp->data + off%BSIZE);
+    for(; off < end; off += sizeof(*de), de++){
+      if(name == 0 ? de->inum == 0 :
+         de->inum != 0 && namecmp(name, de->name) == 0){
+        inum = de->inum;
+        brelse(bp);
+        *poff = off;
+        return inum;
+      }
+    }
+    brelse(bp);
+  }
+  *poff = dp->size;
+  return 0;
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
 struct inode*
 dirlookup(struct inode *dp, char *name, uint *poff)
 {
   uint off, inum;
-  struct dirent de;
+  struct dentry *d;
 
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlookup read");
-    if(de.inum == 0)
-      continue;
-    if(namecmp(name, de.name) == 0){
-      // entry matches path element
-      if(poff)
-        *poff = off;
-      inum = de.inum;
-      return iget(dp->dev, inum);
-    }
+  acquire(&dcache.lock);
+  if((d = dcfind(dp, name)) != 0){
+    dcmove(d, 1);
+    inum = d->inum;
+    off = d->off;
+    release(&dcache.lock);
+    if(inum == 0)
+      return 0;
+    if(poff)
+      *poff = off;
+    return iget(dp->dev, inum);
+  }
+  release(&dcache.lock);
+
+  if((inum = dirscan(dp, name, 0, &off)) != 0){
+    // entry matches path element
+    if(poff)
+      *poff = off;
+    dcset(dp, name, inum, off);
+    return iget(dp->dev, inum);
   }
 
+  dcset(dp, name, 0, 0);
   return 0;
 }
 
@@ -552,7 +1148,7 @@ dirlookup(struct inode *dp, char *name, uint *poff)
 int
 dirlink(struct inode *dp, char *name, uint inum)
 {
-  int off;
+  uint off;
   struct dirent de;
   struct inode *ip;
 
@@ -562,18 +1158,15 @@ dirlink(struct inode *dp, char *name, uint inum)
     return -1;
   }
 
-  // Look for an empty dirent.
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlink read");
-    if(de.inum == 0)
-      break;
-  }
+  // Look for an empty dirent, past those known to be in use.
+  dirscan(dp, 0, dp->dirfree, &off);
 
   strncpy(de.name, name, DIRSIZ);
   de.inum = inum;
   if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
     panic("dirlink");
+  dp->dirfree = off + sizeof(de);
+  dcset(dp, name, inum, off);
 
   return 0;
 }
@@ -19,11 +19,19 @@ struct superblock {
   uint logstart;     // Block number of first log block
   uint inodestart;   // Block number of first inode block
   uint bmapstart;    // Block number of first free map block
+  uint logsize;      // Data blocks in each of the two log regions
 };
 
-#define NDIRECT 12
+#define MAXLOGSIZE 1024  // Most data blocks in a log region
+
+// Header blocks of a log region with n data blocks.  The header
+// holds a count, a sequence number, then the block # of each.
+#define LOGHDRBLKS(n) ((((n) + 2) * sizeof(uint) + BSIZE - 1) / BSIZE)
+
+#define NDIRECT 11
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define NDINDIRECT (NINDIRECT * NINDIRECT)
+#define MAXFILE (NDIRECT + NINDIRECT + NDINDIRECT)
 
 // On-disk inode structure
 struct dinode {
@@ -32,7 +40,7 @@ struct dinode {
   short minor;          // Minor device number (T_DEV only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  uint addrs[NDIRECT+2];   // Data block addresses
 };
 
 // Inodes per block.
@@ -12,6 +12,7 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "dstat.h"
 
 #define SECTOR_SIZE   512
 #define IDE_BSY       0x80
@@ -23,13 +24,22 @@
 #define IDE_CMD_WRITE 0x30
 #define IDE_CMD_RDMUL 0xc4
 #define IDE_CMD_WRMUL 0xc5
+#define IDE_CMD_SETMUL 0xc6
 
-// idequeue points to the buf now being read/written to the disk.
-// idequeue->qnext points to the next buf to be processed.
+#define IDE_MULT      16  // sectors per READ/WRITE MULTIPLE interrupt
+
+// idequeue points to the buf now being read/written to the disk,
+// followed by the idenblk-1 bufs merged into the same command.
+// After them come the bufs waiting for the disk, in the order
+// they arrived; idenext() picks which of them goes next.
 // You must hold idelock while manipulating queue.
 
 static struct spinlock idelock;
 static struct buf *idequeue;
+static struct diskstat stats;
+static uint lastblock;     // block of the last request started
+static int idenblk;        // bufs in the command on the disk
+static int idemaxblk = 1;  // most bufs one command may carry
 
 static int havedisk1;
 static void idestart(struct buf*);
@@ -47,6 +57,18 @@ idewait(int checkerr)
   return 0;
 }
 
+// Set disk d to move IDE_MULT sectors per interrupt in
+// READ/WRITE MULTIPLE.  Returns -1 if the disk refuses.
+static int
+idesetmult(int d)
+{
+  idewait(0);
+  outb(0x1f2, IDE_MULT);
+  outb(0x1f6, 0xe0 | (d<<4));
+  outb(0x1f7, IDE_CMD_SETMUL);
+  return idewait(1);
+}
+
 void
 ideinit(void)
 {
@@ -65,79 +87,173 @@ ideinit(void)
     }
   }
 
+  // Merge adjacent blocks into one command if the disks let
+  // us; interrupts stay off until idestart() turns them on.
+  outb(0x3f6, 0x2);
+  if(idesetmult(0) == 0 && (!havedisk1 || idesetmult(1) == 0))
+    idemaxblk = IDE_MULT / (BSIZE/SECTOR_SIZE);
+
   // Switch back to disk 0.
   outb(0x1f6, 0xe0 | (0<<4));
 }
 
-// Start the request for b.  Caller must hold idelock.
+// Start the request for b, together with any waiting bufs that
+// carry on from it on the disk in the same direction, up to
+// idemaxblk in all; those are moved up to follow b in idequeue.
+// Caller must hold idelock.
 static void
 idestart(struct buf *b)
 {
+  struct buf *p, **pp, *last;
+
   if(b == 0)
     panic("idestart");
   if(b->blockno >= FSSIZE)
     panic("incorrect blockno");
   int sector_per_block =  BSIZE/SECTOR_SIZE;
   int sector = b->blockno * sector_per_block;
-  int read_cmd = (sector_per_block == 1) ? IDE_CMD_READ :  IDE_CMD_RDMUL;
-  int write_cmd = (sector_per_block == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
 
   if (sector_per_block > 7) panic("idestart");
 
+  last = b;
+  for(idenblk = 1; idenblk < idemaxblk; idenblk++){
+    for(pp = &last->qnext; (p = *pp) != 0; pp = &p->qnext)
+      if(p->dev == b->dev && p->blockno == last->blockno + 1 &&
+         (p->flags & B_DIRTY) == (b->flags & B_DIRTY))
+        break;
+    if(p == 0)
+      break;
+    *pp = p->qnext;
+    p->qnext = last->qnext;
+    last->qnext = p;
+    last = p;
+  }
+
+  int nsector = idenblk * sector_per_block;
+  int read_cmd = (nsector == 1) ? IDE_CMD_READ :  IDE_CMD_RDMUL;
+  int write_cmd = (nsector == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
+
+  stats.nreq += idenblk;
+  stats.ncmd++;
+  if(b->blockno != lastblock + 1){
+    stats.nseek++;
+    stats.seekdist += b->blockno > lastblock ?
+      b->blockno - lastblock : lastblock - b->blockno;
+  }
+  lastblock = last->blockno;
+
   idewait(0);
   outb(0x3f6, 0);  // generate interrupt
-  outb(0x1f2, sector_per_block);  // number of sectors
+  outb(0x1f2, nsector);  // number of sectors
   outb(0x1f3, sector & 0xff);
   outb(0x1f4, (sector >> 8) & 0xff);
   outb(0x1f5, (sector >> 16) & 0xff);
   outb(0x1f6, 0xe0 | ((b->dev&1)<<4) | ((sector>>24)&0x0f));
   if(b->flags & B_DIRTY){
     outb(0x1f7, write_cmd);
-    outsl(0x1f0, b->data, BSIZE/4);
+    for(p = b; ; p = p->qnext){
+      outsl(0x1f0, p->data, BSIZE/4);
+      if(p == last)
+        break;
+    }
   } else {
     outb(0x1f7, read_cmd);
   }
 }
 
+// Disk scheduling.  Choose which buf in the waiting list q
+// to start next and move it to the front of q; return the new q.
+// DISK_FIFO takes them in order.  DISK_SCAN sweeps the head
+// upwards from lastblock, taking the nearest block at or past it
+// and wrapping to the lowest when there are none (C-LOOK), except
+// that a read older than IDEDEADLINE goes first so that a stream
+// of nearby requests cannot starve it.  Caller must hold idelock.
+static struct buf*
+idenext(struct buf *q)
+{
+  struct buf **pp, **best, *b;
+
+  if(q == 0)
+    return 0;
+  best = &q;
+  if(DISKSCHED == DISK_SCAN){
+    // q is in arrival order, so the first late read is the oldest.
+    for(pp = &q; *pp; pp = &(*pp)->qnext){
+      b = *pp;
+      if(!(b->flags & B_DIRTY) && ticks - b->qtime >= IDEDEADLINE){
+        stats.expired++;
+        best = pp;
+        break;
+      }
+    }
+    if(*pp == 0){
+      // Unsigned distance up from the head, so lower blocks sort last.
+      for(pp = &q; *pp; pp = &(*pp)->qnext)
+        if((*pp)->blockno - lastblock < (*best)->blockno - lastblock)
+          best = pp;
+    }
+  }
+  b = *best;
+  *best = b->qnext;
+  b->qnext = q;
+  return b;
+}
+
 // Interrupt handler.
 void
 ideintr(void)
 {
-  struct buf *b;
+  struct buf *b, *next, *async[IDE_MULT];
+  int i, n, read;
 
-  // First queued buffer is the active request.
+  // First queued buffers are the active request.
   acquire(&idelock);
 
   if((b = idequeue) == 0){
     release(&idelock);
     return;
   }
-  idequeue = b->qnext;
 
   // Read data if needed.
-  if(!(b->flags & B_DIRTY) && idewait(1) >= 0)
-    insl(0x1f0, b->data, BSIZE/4);
+  read = !(b->flags & B_DIRTY) && idewait(1) >= 0;
+
+  n = 0;
+  for(i = 0; i < idenblk; i++, b = next){
+    next = b->qnext;
+    if(read)
+      insl(0x1f0, b->data, BSIZE/4);
+    // Nobody waits for a read-ahead; it goes back to the cache
+    // below.  Decide now: once woken, other bufs may be reused.
+    if(b->flags & B_ASYNC)
+      async[n++] = b;
 
-  // Wake process waiting for this buf.
-  b->flags |= B_VALID;
-  b->flags &= ~B_DIRTY;
-  wakeup(b);
+    // Wake process waiting for this buf.
+    b->flags |= B_VALID;
+    b->flags &= ~B_DIRTY;
+    wakeup(b);
+  }
 
   // Start disk on next buf in queue.
+  idequeue = idenext(b);
   if(idequeue != 0)
     idestart(idequeue);
 
   release(&idelock);
+
+  for(i = 0; i < n; i++){
+    async[i]->flags &= ~B_ASYNC;
+    brelse(async[i]);
+  }
 }
 
 //PAGEBREAK!
-// Sync buf with disk.
-// If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
-// Else if B_VALID is not set, read buf from disk, set B_VALID.
-void
-iderw(struct buf *b)
+// Append b to idequeue, starting the disk if it is idle.
+// Caller must hold idelock.
+static void
+ideappend(struct buf *b)
 {
   struct buf **pp;
+  uint depth;
 
   if(!holdingsleep(&b->lock))
     panic("iderw: buf not locked");
@@ -146,23 +262,74 @@ iderw(struct buf *b)
   if(b->dev != 0 && !havedisk1)
     panic("iderw: ide disk 1 not present");
 
-  acquire(&idelock);  //DOC:acquire-lock
-
-  // Append b to idequeue.
   b->qnext = 0;
+  b->qtime = ticks;
+  depth = 0;
   for(pp=&idequeue; *pp; pp=&(*pp)->qnext)  //DOC:insert-queue
-    ;
+    depth++;
   *pp = b;
+  stats.depthsum += depth;
+  if(depth > stats.maxdepth)
+    stats.maxdepth = depth;
 
   // Start disk if necessary.
   if(idequeue == b)
     idestart(b);
+}
+
+// Sync buf with disk.
+// If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
+// Else if B_VALID is not set, read buf from disk, set B_VALID.
+void
+iderw(struct buf *b)
+{
+  acquire(&idelock);  //DOC:acquire-lock
+
+  ideappend(b);
 
   // Wait for request to finish.
   while((b->flags & (B_VALID|B_DIRTY)) != B_VALID){
     sleep(b, &idelock);
   }
 
+  release(&idelock);
+}
 
+// Start syncing buf with disk like iderw, but return at once,
+// so that a caller can have many requests in flight.  Wait for
+// it with idecomplete, or set B_ASYNC to have ideintr()
+// release the buf when the request completes.
+void
+idesubmit(struct buf *b)
+{
+  acquire(&idelock);
+  ideappend(b);
+  release(&idelock);
+}
+
+// Wait for a request started by idesubmit to finish.
+void
+idecomplete(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("idecomplete: buf not locked");
+
+  acquire(&idelock);
+  while((b->flags & (B_VALID|B_DIRTY)) != B_VALID)
+    sleep(b, &idelock);
+  release(&idelock);
+}
+
+// Copy the disk queue counters into st.
+void
+idestat(struct diskstat *st)
+{
+  struct diskstat copy;
+
+  // st may be in user memory; writing it can fault, so
+  // not while holding idelock.
+  acquire(&idelock);
+  copy = stats;
   release(&idelock);
+  *st = copy;
 }
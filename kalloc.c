@@ -7,6 +7,7 @@
 #include "param.h"
 #include "memlayout.h"
 #include "mmu.h"
+#include "x86.h"
 #include "spinlock.h"
 
 void freerange(void *vstart, void *vend);
@@ -21,8 +22,26 @@ struct {
   struct spinlock lock;
   int use_lock;
   struct run *freelist;
+  uint ref[PHYSTOP/PGSIZE];    // Mappings of each page; see copyuvm()
 } kmem;
 
+// Per-CPU free lists in front of kmem.freelist, so that the
+// common kalloc()/kfree() path takes no shared lock. A CPU
+// refills or drains KBATCH pages at a time under kmem.lock.
+// Each cache has its own lock, nearly always taken by its own
+// CPU, so that a CPU that finds kmem empty can take pages from
+// the others rather than fail.
+#define KBATCH  32
+#define KCACHE  (2*KBATCH)     // Drain back to kmem above this
+
+struct kcache {
+  struct spinlock lock;
+  struct run *freelist;
+  int n;
+} __attribute__((aligned(64)));
+
+static struct kcache kcache[NCPU];
+
 // Initialization happens in two phases.
 // 1. main() calls kinit1() while still using entrypgdir to place just
 // the pages mapped by entrypgdir on free list.
@@ -31,7 +50,11 @@ struct {
 void
 kinit1(void *vstart, void *vend)
 {
+  int i;
+
   initlock(&kmem.lock, "kmem");
+  for(i = 0; i < NCPU; i++)
+    initlock(&kcache[i].lock, "kcache");
   kmem.use_lock = 0;
   freerange(vstart, vend);
 }
@@ -48,32 +71,130 @@ freerange(void *vstart, void *vend)
 {
   char *p;
   p = (char*)PGROUNDUP((uint)vstart);
-  for(; p + PGSIZE <= (char*)vend; p += PGSIZE)
+  for(; p + PGSIZE <= (char*)vend; p += PGSIZE){
+    kmem.ref[V2P(p)/PGSIZE] = 1;
     kfree(p);
+  }
 }
 //PAGEBREAK: 21
 // Free the page of physical memory pointed at by v,
 // which normally should have been returned by a
 // call to kalloc().  (The exception is when
 // initializing the allocator; see kinit above.)
+// A page shared copy-on-write is only freed when
+// its last reference goes away.
 void
 kfree(char *v)
 {
   struct run *r;
+  struct kcache *kc;
+  uint ref;
+  int i;
 
   if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
     panic("kfree");
 
-  // Fill with junk to catch dangling refs.
-  memset(v, 1, PGSIZE);
+  do {
+    ref = kmem.ref[V2P(v)/PGSIZE];
+    if(ref == 0)
+      panic("kfree: ref");
+  } while(!cas(&kmem.ref[V2P(v)/PGSIZE], ref, ref-1));
+  if(ref > 1)
+    return;
+
+  // Fill with junk to catch dangling refs. Off by default:
+  // kalloc() makes no promise about contents, and callers
+  // that need zeroed pages (allocuvm, walkpgdir, setupkvm,
+  // lazyfault) clear them themselves.
+  if(KPOISON)
+    memset(v, 1, PGSIZE);
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
   r = (struct run*)v;
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  if(kmem.use_lock)
+  if(!kmem.use_lock){
+    // Still booting; other CPUs may not be known yet.
+    r->next = kmem.freelist;
+    kmem.freelist = r;
+    return;
+  }
+
+  pushcli();
+  kc = &kcache[cpuid()];
+  acquire(&kc->lock);
+  r->next = kc->freelist;
+  kc->freelist = r;
+  if(++kc->n > KCACHE){
+    acquire(&kmem.lock);
+    for(i = 0; i < KBATCH; i++){
+      r = kc->freelist;
+      kc->freelist = r->next;
+      r->next = kmem.freelist;
+      kmem.freelist = r;
+    }
     release(&kmem.lock);
+    kc->n -= KBATCH;
+  }
+  release(&kc->lock);
+  popcli();
+}
+
+// Take a page from another CPU's cache, for when this CPU's
+// cache and kmem.freelist are both empty.
+static struct run*
+ksteal(void)
+{
+  struct run *r;
+  struct kcache *kc;
+
+  for(kc = kcache; kc < kcache+NCPU; kc++){
+    acquire(&kc->lock);
+    if((r = kc->freelist) != 0){
+      kc->freelist = r->next;
+      kc->n--;
+      release(&kc->lock);
+      return r;
+    }
+    release(&kc->lock);
+  }
+  return 0;
+}
+
+static char*
+kallocpage(void)
+{
+  struct run *r;
+  struct kcache *kc;
+
+  if(!kmem.use_lock){
+    r = kmem.freelist;
+    if(r)
+      kmem.freelist = r->next;
+  } else {
+    pushcli();
+    kc = &kcache[cpuid()];
+    acquire(&kc->lock);
+    if(kc->freelist == 0){
+      acquire(&kmem.lock);
+      while(kc->n < KBATCH && (r = kmem.freelist) != 0){
+        kmem.freelist = r->next;
+        r->next = kc->freelist;
+        kc->freelist = r;
+        kc->n++;
+      }
+      release(&kmem.lock);
+    }
+    r = kc->freelist;
+    if(r){
+      kc->freelist = r->next;
+      kc->n--;
+    }
+    release(&kc->lock);
+    if(r == 0)
+      r = ksteal();
+    popcli();
+  }
+  if(r)
+    kmem.ref[V2P(r)/PGSIZE] = 1;
+  return (char*)r;
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -82,15 +203,30 @@ kfree(char *v)
 char*
 kalloc(void)
 {
-  struct run *r;
+  char *r;
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
-  if(kmem.use_lock)
-    release(&kmem.lock);
-  return (char*)r;
+  // Out of memory: take some back from the buffer cache.
+  if((r = kallocpage()) == 0 && kmem.use_lock && bshrink() > 0)
+    r = kallocpage();
+  return r;
+}
+
+// Add a reference to an allocated page that is being shared.
+void
+kref(char *v)
+{
+  uint ref;
+
+  do {
+    ref = kmem.ref[V2P(v)/PGSIZE];
+    if(ref == 0)
+      panic("kref");
+  } while(!cas(&kmem.ref[V2P(v)/PGSIZE], ref, ref+1));
 }
 
+// Number of references to an allocated page.
+int
+krefcount(char *v)
+{
+  return kmem.ref[V2P(v)/PGSIZE];
+}
@@ -1,6 +1,7 @@
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "mmu.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "fs.h"
@@ -21,93 +22,200 @@
 // sleeps until the last outstanding end_op() commits.
 //
 // The log is a physical re-do log containing disk blocks.
-// The on-disk log format:
-//   header block, containing block #s for block A, B, C, ...
+// It has two regions, each with the on-disk format:
+//   header blocks, containing block #s for block A, B, C, ...
 //   block A
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
+// Transactions alternate between the regions (group commit).
+// When the last system call of a transaction ends, its blocks
+// are copied aside and it is committed, while new system calls
+// start filling the next transaction in the other region. A
+// commit writes its region's header only after the previous
+// transaction has been installed and its header erased, so at
+// most one region on disk ever holds a committed header; the
+// erase also frees that region for the transaction after next.
+// Headers carry sequence numbers; recovery replays both
+// regions, older first.
+// Log appends are synchronous, but the blocks of one append
+// go to the disk together rather than one request at a time.
+//
+// mkfs chooses how many data blocks a region has (log.size, up
+// to MAXLOGSIZE).  A header that does not fit in one block goes
+// on in the blocks after it; only the first one, which holds the
+// count, is written at the commit point, the rest beforehand.
 
-// Contents of the header block, used for both the on-disk header block
-// and to keep track in memory of logged block# before commit.
+// Contents of the header blocks, used to keep track in memory
+// of logged block# before commit.  On disk, n and seq come
+// first, then the block #s, HPB to a header block.
 struct logheader {
   int n;
-  int block[LOGSIZE];
+  uint seq;
+  int *block;      // log.size of them
 };
 
+#define HPB (BSIZE / sizeof(int))
+
 struct log {
   struct spinlock lock;
   int start;
-  int size;
+  int size;        // data blocks in each region
+  int nhead;       // header blocks in each region
   int outstanding; // how many FS sys calls are executing.
-  int committing;  // in commit(), please wait.
+  int reserved;    // log blocks they may still write, at most
+  int sealing;     // copying the open transaction aside, please wait.
   int dev;
-  struct logheader lh;
+  int cur;         // region of the open transaction
+  int busy[2];     // region's transaction is being committed
+  uint seq;        // transactions sealed so far
+  uint done;       // transactions committed and installed so far
+  struct logheader lh[2];
+  // Frozen copies of each region's blocks, written to the log and
+  // then home while later system calls change the cached blocks.
+  struct buf **copy[2];
 };
 struct log log;
 
 static void recover_from_log(void);
-static void commit();
+static void commit(int);
+
+// Allocate a zeroed page for the log.
+static void*
+logpage(void)
+{
+  char *p;
+
+  if ((p = kalloc()) == 0)
+    panic("initlog: out of memory");
+  memset(p, 0, PGSIZE);
+  return p;
+}
 
 void
 initlog(int dev)
 {
-  if (sizeof(struct logheader) >= BSIZE)
-    panic("initlog: too big logheader");
+  struct buf *b;
+  int r, i;
+
+  if (MAXLOGSIZE * sizeof(int) > PGSIZE ||
+     MAXLOGSIZE * sizeof(struct buf*) > PGSIZE)
+    panic("initlog: MAXLOGSIZE");
 
   struct superblock sb;
   initlock(&log.lock, "log");
   readsb(dev, &sb);
   log.start = sb.logstart;
-  log.size = sb.nlog;
+  log.size = sb.logsize;
+  log.nhead = LOGHDRBLKS(log.size);
   log.dev = dev;
+  if (log.size < MAXOPBLOCKS || log.size > MAXLOGSIZE ||
+     2*(log.nhead + log.size) > sb.nlog)
+    panic("initlog: bad log size");
+  // The copies never enter the buffer cache; hold their locks
+  // for good, as the disk driver expects of any buf it is given.
+  for (r = 0; r < 2; r++) {
+    log.lh[r].block = logpage();
+    log.copy[r] = logpage();
+    b = 0;
+    for (i = 0; i < log.size; i++) {
+      if (i % (PGSIZE / sizeof(struct buf)) == 0)
+        b = logpage();
+      initsleeplock(&b->lock, "logcopy");
+      acquiresleep(&b->lock);
+      b->dev = dev;
+      log.copy[r][i] = b++;
+    }
+  }
   recover_from_log();
 }
 
-// Copy committed blocks from log to their home location
+// Block number of region r's first header block.
+static int
+loghead(int r)
+{
+  return log.start + r*(log.nhead + log.size);
+}
+
+// Block number of region r's data block tail.
+static int
+logslot(int r, int tail)
+{
+  return loghead(r) + log.nhead + tail;
+}
+
+static void install(int);
+
+// Copy committed blocks from region r of the log to their home
+// location.  Only used by recovery: commit() writes the frozen
+// copies home instead of reading the log back.
 static void
-install_trans(void)
+install_trans(int r)
 {
+  struct buf *b;
   int tail;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    brelse(lbuf);
-    brelse(dbuf);
+  // Read the whole transaction into the copies, then install.
+  for (tail = 0; tail < log.lh[r].n; tail++) {
+    b = log.copy[r][tail];
+    b->blockno = logslot(r, tail);
+    b->flags = 0;
+    idesubmit(b);
   }
+  for (tail = 0; tail < log.lh[r].n; tail++)
+    bwait(log.copy[r][tail]);
+  install(r);
 }
 
-// Read the log header from disk into the in-memory log header
+// Read region r's log header from disk into the in-memory log header
 static void
-read_head(void)
+read_head(int r)
 {
-  struct buf *buf = bread(log.dev, log.start);
-  struct logheader *lh = (struct logheader *) (buf->data);
+  struct buf *buf = bread(log.dev, loghead(r));
+  int *w = (int*)buf->data;
+  struct logheader *lh = &log.lh[r];
   int i;
-  log.lh.n = lh->n;
-  for (i = 0; i < log.lh.n; i++) {
-    log.lh.block[i] = lh->block[i];
+  lh->n = w[0];
+  lh->seq = w[1];
+  if (lh->n < 0 || lh->n > log.size)
+    panic("read_head: bad log header");
+  for (i = 0; i < lh->n; i++) {
+    if ((i+2) % HPB == 0) {
+      brelse(buf);
+      buf = bread(log.dev, loghead(r) + (i+2)/HPB);
+      w = (int*)buf->data;
+    }
+    lh->block[i] = w[(i+2) % HPB];
   }
   brelse(buf);
 }
 
-// Write in-memory log header to disk.
-// This is the true point at which the
-// current transaction commits.
-static void
-write_head(void)
+// Fill header block k of region r from the in-memory header.
+// Returns the locked buf, for the caller to write.
+static struct buf*
+fill_head(int r, int k)
 {
-  struct buf *buf = bread(log.dev, log.start);
-  struct logheader *hb = (struct logheader *) (buf->data);
+  struct buf *buf = bread(log.dev, loghead(r) + k);
+  int *w = (int*)buf->data;
+  struct logheader *lh = &log.lh[r];
   int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
+  if (k == 0) {
+    w[0] = lh->n;
+    w[1] = lh->seq;
   }
+  for (i = k == 0 ? 0 : k*HPB - 2; i < lh->n && i < (k+1)*HPB - 2; i++)
+    w[(i+2) % HPB] = lh->block[i];
+  return buf;
+}
+
+// Write the first block of region r's in-memory log header to
+// disk; write_log() has already written the rest.
+// This is the true point at which the
+// region's transaction commits.
+static void
+write_head(int r)
+{
+  struct buf *buf = fill_head(r, 0);
   bwrite(buf);
   brelse(buf);
 }
@@ -115,25 +223,53 @@ write_head(void)
 static void
 recover_from_log(void)
 {
-  read_head();
-  install_trans(); // if committed, copy from log to disk
-  log.lh.n = 0;
-  write_head(); // clear the log
+  int i, r, first;
+
+  read_head(0);
+  read_head(1);
+  first = log.lh[1].n > 0 && (log.lh[0].n == 0 || log.lh[1].seq < log.lh[0].seq);
+  for (i = 0; i < 2; i++) {
+    r = first ^ i;
+    install_trans(r); // if committed, copy from log to disk
+    log.lh[r].n = 0;
+  }
+  // Clear the older first: alone, the newer is still safe to replay.
+  for (i = 0; i < 2; i++)
+    write_head(first ^ i); // clear the log
+}
+
+// Most blocks one system call may reserve with begin_opn():
+// half a region, so that other system calls still fit beside it.
+int
+logopmax(void)
+{
+  return log.size/2 < MAXOPBLOCKS ? MAXOPBLOCKS : log.size/2;
 }
 
 // called at the start of each FS system call.
 void
 begin_op(void)
+{
+  begin_opn(MAXOPBLOCKS);
+}
+
+// Like begin_op(), for a system call that writes up to n blocks,
+// at most logopmax(); end it with end_opn(n).
+void
+begin_opn(int n)
 {
   acquire(&log.lock);
   while(1){
-    if(log.committing){
+    if(log.sealing || log.busy[log.cur]){
+      // the open transaction is being set aside, or the
+      // region it needs still holds one being committed.
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
+    } else if(log.lh[log.cur].n + log.reserved + n > log.size){
       // this op might exhaust log space; wait for commit.
       sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
+      log.reserved += n;
       release(&log.lock);
       break;
     }
@@ -145,65 +281,176 @@ begin_op(void)
 void
 end_op(void)
 {
-  int do_commit = 0;
+  end_opn(MAXOPBLOCKS);
+}
+
+void
+end_opn(int n)
+{
+  int r = -1;
 
   acquire(&log.lock);
   log.outstanding -= 1;
-  if(log.committing)
-    panic("log.committing");
-  if(log.outstanding == 0){
-    do_commit = 1;
-    log.committing = 1;
+  log.reserved -= n;
+  if(log.sealing)
+    panic("log.sealing");
+  if(log.outstanding == 0 && log.lh[log.cur].n > 0){
+    // Seal the open transaction; later system calls go to
+    // the other region once its blocks have been copied.
+    r = log.cur;
+    log.cur = 1 - r;
+    log.busy[r] = 1;
+    log.sealing = 1;
   } else {
     // begin_op() may be waiting for log space,
-    // and decrementing log.outstanding has decreased
+    // and decrementing log.reserved has decreased
     // the amount of reserved space.
     wakeup(&log);
   }
   release(&log.lock);
 
-  if(do_commit){
+  if(r >= 0){
     // call commit w/o holding locks, since not allowed
     // to sleep with locks.
-    commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
-    release(&log.lock);
+    commit(r);
   }
 }
 
-// Copy modified blocks from cache to log.
+// Copy the modified blocks of region r's transaction from the
+// cache into its frozen copies.  Caller has set log.sealing,
+// so nobody is changing the cached blocks.
 static void
-write_log(void)
+freeze(int r)
 {
+  struct buf *from, *to;
   int tail;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
+  for (tail = 0; tail < log.lh[r].n; tail++) {
+    from = bread(log.dev, log.lh[r].block[tail]); // cache block
+    to = log.copy[r][tail];
     memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
+    to->flags = B_VALID;
     brelse(from);
-    brelse(to);
   }
 }
 
+// Write region r's frozen copies to the log, along with any
+// header blocks after the first, all at once, and wait for them.
 static void
-commit()
-{
-  if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(); // Now install writes to home locations
-    log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+write_log(int r)
+{
+  struct buf *b, *hb[LOGHDRBLKS(MAXLOGSIZE)];
+  int tail, k, nk;
+
+  nk = LOGHDRBLKS(log.lh[r].n);
+  for (k = 1; k < nk; k++) {
+    hb[k] = fill_head(r, k);
+    bwriteasync(hb[k]);
+  }
+  for (tail = 0; tail < log.lh[r].n; tail++) {
+    b = log.copy[r][tail];
+    b->blockno = logslot(r, tail);
+    bwriteasync(b);
+  }
+  for (k = 1; k < nk; k++) {
+    bwait(hb[k]);
+    brelse(hb[k]);
+  }
+  for (tail = 0; tail < log.lh[r].n; tail++)
+    bwait(log.copy[r][tail]);
+}
+
+// Has the transaction after region r's logged blockno?
+// Caller holds log.lock.
+static int
+relogged(int r, uint blockno)
+{
+  struct logheader *next = &log.lh[1-r];
+  int i;
+
+  for (i = 0; i < next->n; i++)
+    if (next->block[i] == blockno)
+      return 1;
+  return 0;
+}
+
+// Write region r's frozen copies home, all at once, and wait.
+// Only recovery ever reads the log back.
+static void
+install(int r)
+{
+  struct buf *b;
+  int tail;
+
+  for (tail = 0; tail < log.lh[r].n; tail++) {
+    b = log.copy[r][tail];
+    b->blockno = log.lh[r].block[tail];
+    bwriteasync(b);
+  }
+  for (tail = 0; tail < log.lh[r].n; tail++)
+    bwait(log.copy[r][tail]);
+}
+
+// The installed blocks of region r's transaction no longer need
+// pinning in the cache, unless the next transaction has logged
+// them too.
+static void
+unpin(int r)
+{
+  struct buf *b;
+  int tail;
+
+  for (tail = 0; tail < log.lh[r].n; tail++) {
+    b = bread(log.dev, log.lh[r].block[tail]);
+    acquire(&log.lock);
+    if (!relogged(r, b->blockno))
+      b->flags &= ~B_DIRTY;
+    release(&log.lock);
+    brelse(b);
   }
 }
 
+static void
+commit(int r)
+{
+  uint seq;
+
+  freeze(r);
+  acquire(&log.lock);
+  log.sealing = 0;
+  seq = log.lh[r].seq = ++log.seq;
+  wakeup(&log);
+  release(&log.lock);
+
+  write_log(r);     // Write frozen blocks to the log
+
+  // Commit and install in order behind the previous transaction.
+  acquire(&log.lock);
+  while (log.done != seq - 1)
+    sleep(&log.done, &log.lock);
+  release(&log.lock);
+
+  write_head(r);    // Write header to disk -- the real commit
+  install(r);       // Now install writes to home locations
+  unpin(r);
+  acquire(&log.lock);
+  log.lh[r].n = 0;
+  release(&log.lock);
+  write_head(r);    // Erase the transaction from the log
+
+  // Free the region for the transaction after next, which may
+  // be waiting in begin_op() while the next one commits.
+  acquire(&log.lock);
+  log.busy[r] = 0;
+  log.done = seq;
+  wakeup(&log);
+  wakeup(&log.done);
+  release(&log.lock);
+}
+
 // Caller has modified b->data and is done with the buffer.
 // Record the block number and pin in the cache with B_DIRTY.
-// commit()/write_log() will do the disk write.
+// commit() will do the disk write.
 //
 // log_write() replaces bwrite(); a typical use is:
 //   bp = bread(...)
@@ -213,22 +460,23 @@ commit()
 void
 log_write(struct buf *b)
 {
+  struct logheader *lh;
   int i;
 
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
-    panic("too big a transaction");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
 
   acquire(&log.lock);
-  for (i = 0; i < log.lh.n; i++) {
-    if (log.lh.block[i] == b->blockno)   // log absorbtion
+  lh = &log.lh[log.cur];
+  if (lh->n >= log.size)
+    panic("too big a transaction");
+  for (i = 0; i < lh->n; i++) {
+    if (lh->block[i] == b->blockno)   // log absorbtion
       break;
   }
-  log.lh.block[i] = b->blockno;
-  if (i == log.lh.n)
-    log.lh.n++;
+  lh->block[i] = b->blockno;
+  if (i == lh->n)
+    lh->n++;
   b->flags |= B_DIRTY; // prevent eviction
   release(&log.lock);
 }
-
@@ -15,14 +15,13 @@
 #define static_assert(a, b) do { switch (0) case 0: case (a): ; } while (0)
 #endif
 
-#define NINODES 200
-
 // Disk layout:
 // [ boot block | sb block | log | inode blocks | free bit map | data blocks ]
 
 int nbitmap = FSSIZE/(BSIZE*8) + 1;
 int ninodeblocks = NINODES / IPB + 1;
-int nlog = LOGSIZE;
+int logsize = LOGSIZE;  // Data blocks per log region
+int nlog;     // Number of log blocks: two regions of header + data
 int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
 int nblocks;  // Number of data blocks
 
@@ -37,6 +36,7 @@ void balloc(int);
 void wsect(uint, void*);
 void winode(uint, struct dinode*);
 void rinode(uint inum, struct dinode *ip);
+void fsck(void);
 void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
@@ -76,8 +76,13 @@ main(int argc, char *argv[])
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
 
-  if(argc < 2){
-    fprintf(stderr, "Usage: mkfs fs.img files...\n");
+  if(argc > 2 && strcmp(argv[1], "-l") == 0){
+    logsize = atoi(argv[2]);
+    argv += 2;
+    argc -= 2;
+  }
+  if(argc < 2 || logsize < MAXOPBLOCKS || logsize > MAXLOGSIZE){
+    fprintf(stderr, "Usage: mkfs [-l logblocks] fs.img files...\n");
     exit(1);
   }
 
@@ -91,6 +96,7 @@ main(int argc, char *argv[])
   }
 
   // 1 fs block = 1 disk sector
+  nlog = 2 * (LOGHDRBLKS(logsize) + logsize);
   nmeta = 2 + nlog + ninodeblocks + nbitmap;
   nblocks = FSSIZE - nmeta;
 
@@ -101,6 +107,7 @@ main(int argc, char *argv[])
   sb.logstart = xint(2);
   sb.inodestart = xint(2+nlog);
   sb.bmapstart = xint(2+nlog+ninodeblocks);
+  sb.logsize = xint(logsize);
 
   printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d total %d\n",
          nmeta, nlog, ninodeblocks, nbitmap, nblocks, FSSIZE);
@@ -158,11 +165,12 @@ main(int argc, char *argv[])
   // fix size of root inode dir
   rinode(rootino, &din);
   off = xint(din.size);
-  off = ((off/BSIZE) + 1) * BSIZE;
+  off = ((off + BSIZE - 1)/BSIZE) * BSIZE;
   din.size = xint(off);
   winode(rootino, &din);
 
   balloc(freeblock);
+  fsck();
 
   exit(0);
 }
@@ -252,6 +260,23 @@ balloc(int used)
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
+// Return entry i of indirect block *ind, allocating the
+// indirect block and the entry's block as needed.
+uint
+iindirect(uint *ind, uint i)
+{
+  uint a[NINDIRECT];
+
+  if(xint(*ind) == 0)
+    *ind = xint(freeblock++);
+  rsect(xint(*ind), (char*)a);
+  if(a[i] == 0){
+    a[i] = xint(freeblock++);
+    wsect(xint(*ind), (char*)a);
+  }
+  return xint(a[i]);
+}
+
 void
 iappend(uint inum, void *xp, int n)
 {
@@ -259,8 +284,7 @@ iappend(uint inum, void *xp, int n)
   uint fbn, off, n1;
   struct dinode din;
   char buf[BSIZE];
-  uint indirect[NINDIRECT];
-  uint x;
+  uint x, ind;
 
   rinode(inum, &din);
   off = xint(din.size);
@@ -273,16 +297,13 @@ iappend(uint inum, void *xp, int n)
         din.addrs[fbn] = xint(freeblock++);
       }
       x = xint(din.addrs[fbn]);
+    } else if(fbn < NDIRECT + NINDIRECT){
+      x = iindirect(&din.addrs[NDIRECT], fbn - NDIRECT);
     } else {
-      if(xint(din.addrs[NDIRECT]) == 0){
-        din.addrs[NDIRECT] = xint(freeblock++);
-      }
-      rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      if(indirect[fbn - NDIRECT] == 0){
-        indirect[fbn - NDIRECT] = xint(freeblock++);
-        wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      }
-      x = xint(indirect[fbn-NDIRECT]);
+      fbn -= NDIRECT + NINDIRECT;
+      ind = xint(iindirect(&din.addrs[NDIRECT+1], fbn / NINDIRECT));
+      x = iindirect(&ind, fbn % NINDIRECT);
+      fbn = off / BSIZE;
     }
     n1 = min(n, (fbn + 1) * BSIZE - off);
     rsect(x, buf);
@@ -295,3 +316,138 @@ iappend(uint inum, void *xp, int n)
   din.size = xint(off);
   winode(inum, &din);
 }
+
+//PAGEBREAK!
+// Check the image just built, the way a file system checker
+// would: every block an inode uses is a data block used only
+// once, the bitmap marks exactly the blocks in use, files have
+// a block for every byte of their size and none past it, and
+// directory entries name allocated inodes as often as their
+// link counts say.
+
+uchar owner[FSSIZE];   // block is used by some inode, or is metadata
+short nref[NINODES];   // directory entries naming each inode
+int nbad;
+
+void
+fsckerr(char *msg, uint inum, uint bn)
+{
+  fprintf(stderr, "fsck: inode %u: %s (block %u)\n", inum, msg, bn);
+  nbad++;
+}
+
+// Record that inode inum uses block b, which holds file block
+// fbn if depth is 0, or is an indirect block depth levels above
+// the data, starting at file block fbn.  Returns the number of
+// data blocks under b.
+uint
+fsckblock(uint inum, uint b, uint fbn, uint nfbn, int depth)
+{
+  uint a[NINDIRECT];
+  uint i, n, span;
+
+  if(b < nmeta || b >= FSSIZE){
+    fsckerr("block out of range", inum, b);
+    return 0;
+  }
+  if(owner[b]){
+    fsckerr("block used twice", inum, b);
+    return 0;
+  }
+  owner[b] = 1;
+  if(depth == 0){
+    if(fbn >= nfbn)
+      fsckerr("block past end of file", inum, b);
+    return 1;
+  }
+  rsect(b, (char*)a);
+  span = depth == 1 ? 1 : NINDIRECT;
+  n = 0;
+  for(i = 0; i < NINDIRECT; i++){
+    if(a[i])
+      n += fsckblock(inum, xint(a[i]), fbn + i*span, nfbn, depth - 1);
+  }
+  return n;
+}
+
+void
+fsck(void)
+{
+  struct dinode din;
+  struct dirent de;
+  uchar buf[BSIZE];
+  uint inum, b, off, nfbn, n, ninode, nused;
+  int i, type;
+
+  for(b = 0; b < nmeta; b++)
+    owner[b] = 1;
+
+  ninode = 0;
+  for(inum = 1; inum < NINODES; inum++){
+    rinode(inum, &din);
+    if(xshort(din.type) == 0)
+      continue;
+    ninode++;
+    if(xint(din.size) > MAXFILE*BSIZE){
+      fsckerr("too big", inum, 0);
+      continue;
+    }
+    nfbn = (xint(din.size) + BSIZE - 1) / BSIZE;
+    n = 0;
+    for(i = 0; i < NDIRECT+2; i++){
+      if(din.addrs[i] == 0)
+        continue;
+      if(i < NDIRECT)
+        n += fsckblock(inum, xint(din.addrs[i]), i, nfbn, 0);
+      else if(i == NDIRECT)
+        n += fsckblock(inum, xint(din.addrs[i]), NDIRECT, nfbn, 1);
+      else
+        n += fsckblock(inum, xint(din.addrs[i]), NDIRECT+NINDIRECT, nfbn, 2);
+    }
+    if(n != nfbn)
+      fsckerr("size does not match blocks", inum, 0);
+
+    if(xshort(din.type) != T_DIR)
+      continue;
+    for(off = 0; off < xint(din.size); off += sizeof(de)){
+      b = off / BSIZE;
+      if(b >= NDIRECT)
+        break;  // mkfs never makes directories that big
+      rsect(xint(din.addrs[b]), buf);
+      memmove(&de, buf + off%BSIZE, sizeof(de));
+      if(de.inum == 0 || strncmp(de.name, ".", DIRSIZ) == 0)
+        continue;
+      if(xshort(de.inum) >= NINODES){
+        fsckerr("entry names bad inode", inum, xshort(de.inum));
+        continue;
+      }
+      nref[xshort(de.inum)]++;
+    }
+  }
+
+  for(inum = 1; inum < NINODES; inum++){
+    rinode(inum, &din);
+    type = xshort(din.type);
+    if(type == 0 && nref[inum] != 0)
+      fsckerr("free inode in a directory", inum, 0);
+    if(type != 0 && nref[inum] != xshort(din.nlink))
+      fsckerr("link count does not match entries", inum, 0);
+  }
+
+  nused = 0;
+  for(b = 0; b < FSSIZE; b++){
+    if(b % BPB == 0)
+      rsect(BBLOCK(b, sb), buf);
+    i = (buf[(b%BPB)/8] >> (b%8)) & 1;
+    if(i != owner[b])
+      fsckerr(i ? "block marked in use but unused" : "block in use but free",
+              0, b);
+    nused += owner[b];
+  }
+
+  if(nbad){
+    fprintf(stderr, "fsck: %d errors\n", nbad);
+    exit(1);
+  }
+  printf("fsck: %u inodes, %u blocks in use, ok\n", ninode, nused);
+}
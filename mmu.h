@@ -141,6 +141,12 @@ struct segdesc {
 #define PTE_D           0x040   // Dirty
 #define PTE_PS          0x080   // Page Size
 #define PTE_MBZ         0x180   // Bits must be zero
+#define PTE_COW         0x200   // Copy-on-write (available to software)
+
+// Page fault error code bits
+#define FEC_PR          0x001   // Protection violation (page was present)
+#define FEC_WR          0x002   // Fault was caused by a write
+#define FEC_U           0x004   // Fault happened in user mode
 
 // Address in page table or page directory entry
 #define PTE_ADDR(pte)   ((uint)(pte) & ~0xFFF)
@@ -3,14 +3,36 @@
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#ifndef NINODE
+#define NINODE      200  // size of in-memory inode cache; make NINODE=n
+#endif
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
-#define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000  // size of file system in blocks
+#define MAXOPBLOCKS  32  // max # of blocks any FS op writes
+#define LOGSIZE      (MAXOPBLOCKS*4)  // mkfs default data blocks per log region
+#define NBUF         (MAXOPBLOCKS*3)  // static part of disk block cache
+#define BCACHEFRAC   64  // block cache grows to 1/BCACHEFRAC of phys memory
+#define FSSIZE       20000 // size of file system in blocks
+#define NINODES      4096  // inodes in the file system mkfs builds
+#define NREADAHEAD    8  // blocks readi() keeps in flight for sequential readers
+
+#define SCHED_RR      0  // round robin over the run queues
+#define SCHED_MLFQ    1  // multi-level feedback queue
+#ifndef SCHEDPOLICY
+#define SCHEDPOLICY  SCHED_RR  // scheduling policy; make SCHEDPOLICY=SCHED_MLFQ
+#endif
+#define NPRIO         3  // MLFQ priority levels; level n gets 1<<n ticks
+#define BOOSTTICKS  100  // MLFQ moves every proc back to level 0 this often
+#define DISK_FIFO     0  // serve disk requests in arrival order
+#define DISK_SCAN     1  // elevator by block number, with a read deadline
+#ifndef DISKSCHED
+#define DISKSCHED    DISK_SCAN  // disk scheduler; make DISKSCHED=DISK_FIFO
+#endif
+#define IDEDEADLINE   5  // ticks a read waits before DISK_SCAN takes it next
+#ifndef KPOISON
+#define KPOISON       0  // kfree() junk-fills pages; make KPOISON=1 to debug
+#endif
 
 #define SIG_DFL -1 
 #define SIG_IGN 1
@@ -0,0 +1,917 @@
+// Performance benchmarks. Each prints the ticks it took, so
+// runs can be compared across kernel changes; like usertests,
+// a benchmark prints "ok" at the end unless something broke.
+
+#include "param.h"
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fs.h"
+#include "fcntl.h"
+#include "pstat.h"
+#include "bstat.h"
+#include "dstat.h"
+
+#define BIGFILE (2048*BSIZE)  // bytes in the benchmarks' large files
+
+// Time a benchmark loop: call body(arg, w, i) for i = 0..n-1, in
+// this proc if nproc is 0, or else in each of nproc forked procs,
+// w being the proc's index.  Prints "name: n what in t ticks" and
+// returns t.  body prints a message and exits if something breaks.
+int
+timeit(char *name, int nproc, int n, char *what,
+       void (*body)(void*, int, int), void *arg)
+{
+  int w, i, pid, t;
+
+  t = uptime();
+  if(nproc == 0){
+    for(i = 0; i < n; i++)
+      body(arg, 0, i);
+  } else {
+    for(w = 0; w < nproc; w++){
+      pid = fork();
+      if(pid < 0){
+        printf(1, "%s: fork failed\n", name);
+        exit();
+      }
+      if(pid == 0){
+        for(i = 0; i < n; i++)
+          body(arg, w, i);
+        exit();
+      }
+    }
+    for(w = 0; w < nproc; w++)
+      wait();
+  }
+  t = uptime() - t;
+  if(nproc == 0)
+    printf(1, "%s: %d %s in %d ticks\n", name, n, what, t);
+  else
+    printf(1, "%s: %d procs, %d %s each in %d ticks\n",
+           name, nproc, n, what, t);
+  return t;
+}
+
+// One pipe ping-pong round trip: write a byte to fd[0], and
+// read the echo back from fd[1].
+static void
+roundtrip(void *arg, int w, int i)
+{
+  int *fd = arg;
+  char c;
+
+  write(fd[0], "x", 1);
+  if(read(fd[1], &c, 1) != 1){
+    printf(1, "round trip: read failed\n");
+    exit();
+  }
+}
+
+// time pipe ping-pong round trips while a growing number of
+// unrelated procs sleep; wakeup cost should not grow with them.
+void
+wakeupbench(void)
+{
+  static int nsleepers[] = { 0, 16, 32, 48 };
+  int park[2], ping[2], pong[2], fd[2];
+  int i, j, pid;
+  char c;
+
+  printf(1, "wakeupbench test\n");
+  for(i = 0; i < sizeof(nsleepers)/sizeof(nsleepers[0]); i++){
+    if(pipe(park) != 0 || pipe(ping) != 0 || pipe(pong) != 0){
+      printf(1, "wakeupbench: pipe failed\n");
+      exit();
+    }
+    for(j = 0; j < nsleepers[i]; j++){
+      pid = fork();
+      if(pid < 0){
+        printf(1, "wakeupbench: fork failed\n");
+        exit();
+      }
+      if(pid == 0){
+        close(park[1]);
+        read(park[0], &c, 1);
+        exit();
+      }
+    }
+    close(park[0]);
+
+    pid = fork();
+    if(pid < 0){
+      printf(1, "wakeupbench: fork failed\n");
+      exit();
+    }
+    if(pid == 0){
+      close(park[1]);
+      close(ping[1]);
+      close(pong[0]);
+      while(read(ping[0], &c, 1) == 1)
+        write(pong[1], &c, 1);
+      exit();
+    }
+
+    printf(1, "wakeupbench: %d sleepers\n", nsleepers[i]);
+    fd[0] = ping[1];
+    fd[1] = pong[0];
+    timeit("wakeupbench", 0, 2000, "round trips", roundtrip, fd);
+
+    close(park[1]);
+    close(ping[0]);
+    close(ping[1]);
+    close(pong[0]);
+    close(pong[1]);
+    for(j = 0; j <= nsleepers[i]; j++)
+      wait();
+  }
+  printf(1, "wakeupbench ok\n");
+}
+
+// several pipe ping-pong pairs at once, so that wakeups often
+// find the sleeper still on its way into the scheduler.  Each
+// worker sets up its pair in its own copy of fd on the first
+// round trip and takes it down after the last.  Each CPU's
+// handoffs are such wakeups, which wakeup1() used to spin on;
+// its idle ticks are time it had nothing to run.
+#define PPNROUND 2000
+
+static void
+pingpair(void *arg, int w, int i)
+{
+  int *fd = arg;
+  int ping[2], pong[2];
+  int pid;
+  char c;
+
+  if(i == 0){
+    if(pipe(ping) != 0 || pipe(pong) != 0){
+      printf(1, "pingpongstress: pipe failed\n");
+      exit();
+    }
+    pid = fork();
+    if(pid < 0){
+      printf(1, "pingpongstress: fork failed\n");
+      exit();
+    }
+    if(pid == 0){
+      close(ping[1]);
+      close(pong[0]);
+      while(read(ping[0], &c, 1) == 1)
+        write(pong[1], &c, 1);
+      exit();
+    }
+    close(ping[0]);
+    close(pong[1]);
+    fd[0] = ping[1];
+    fd[1] = pong[0];
+  }
+  roundtrip(fd, w, i);
+  if(i == PPNROUND - 1){
+    close(fd[0]);
+    wait();
+  }
+}
+
+void
+pingpongstress(void)
+{
+  struct cpustat cs0[NCPU], cs[NCPU];
+  int fd[2];
+  int i, n;
+
+  printf(1, "pingpongstress test\n");
+  if((n = getcpustats(cs0, NCPU)) < 0){
+    printf(1, "pingpongstress: getcpustats failed\n");
+    exit();
+  }
+  timeit("pingpongstress", 4, PPNROUND, "round trips", pingpair, fd);
+  if(getcpustats(cs, NCPU) != n){
+    printf(1, "pingpongstress: getcpustats failed\n");
+    exit();
+  }
+  for(i = 0; i < n; i++)
+    printf(1, "pingpongstress: cpu %d: %d handoffs, %d ticks idle\n", i,
+           cs[i].handoffs - cs0[i].handoffs, cs[i].idleticks - cs0[i].idleticks);
+  printf(1, "pingpongstress ok\n");
+}
+
+// Low 32 bits of the cycle counter, which is good enough
+// for differences of less than a second or so.
+static uint
+rdtsc(void)
+{
+  uint lo, hi;
+
+  asm volatile("rdtsc" : "=a" (lo), "=d" (hi));
+  return lo;
+}
+
+// Wakeup-to-run latency.  The parent writes the cycle count
+// to a pipe that a child is blocked reading, and the child
+// sends back how many cycles passed until it ran again.  Both
+// sleep between pings, so CPUs go idle, and the wakeup usually
+// has to start a halted CPU.
+void
+dispatchbench(void)
+{
+  enum { N = 500 };
+  int ping[2], pong[2];
+  uint t, sum, max;
+  int i, pid;
+
+  printf(1, "dispatchbench test\n");
+  if(pipe(ping) != 0 || pipe(pong) != 0){
+    printf(1, "dispatchbench: pipe failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid < 0){
+    printf(1, "dispatchbench: fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    close(ping[1]);
+    close(pong[0]);
+    while(read(ping[0], &t, sizeof(t)) == sizeof(t)){
+      t = rdtsc() - t;
+      write(pong[1], &t, sizeof(t));
+    }
+    exit();
+  }
+  close(ping[0]);
+  close(pong[1]);
+
+  sum = max = 0;
+  for(i = 0; i < N; i++){
+    t = rdtsc();
+    write(ping[1], &t, sizeof(t));
+    if(read(pong[0], &t, sizeof(t)) != sizeof(t)){
+      printf(1, "dispatchbench: read failed\n");
+      exit();
+    }
+    sum += t;
+    if(t > max)
+      max = t;
+  }
+  close(ping[1]);
+  close(pong[0]);
+  wait();
+  printf(1, "dispatchbench: %d wakeups, %d cycles to run on average, %d at most\n",
+         N, sum / N, max);
+  printf(1, "dispatchbench ok\n");
+}
+
+static void
+forkexit(void *arg, int w, int i)
+{
+  int pid;
+
+  pid = fork();
+  if(pid < 0){
+    printf(1, "fork failed\n");
+    exit();
+  }
+  if(pid == 0)
+    exit();
+  wait();
+}
+
+static void
+forkexec(void *arg, int w, int i)
+{
+  static char *argv[] = { "echo", 0 };
+  int pid;
+
+  pid = fork();
+  if(pid < 0){
+    printf(1, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    exec("echo", argv);
+    printf(1, "exec echo failed\n");
+    exit();
+  }
+  wait();
+}
+
+// fork and fork+exec latency with a 1MB heap, which
+// copy-on-write fork no longer copies; also checks that
+// a child's writes stay private to the child.
+void
+forkbench(void)
+{
+  enum { N = 100, HEAP = 1024*1024 };
+  char *heap;
+  int i, pid;
+
+  printf(1, "forkbench test\n");
+  heap = sbrk(HEAP);
+  if(heap == (char*)-1){
+    printf(1, "forkbench: sbrk failed\n");
+    exit();
+  }
+  for(i = 0; i < HEAP; i += 4096)
+    heap[i] = 'p';
+
+  pid = fork();
+  if(pid < 0){
+    printf(1, "forkbench: fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    for(i = 0; i < HEAP; i += 4096)
+      heap[i] = 'c';
+    exit();
+  }
+  wait();
+  for(i = 0; i < HEAP; i += 4096){
+    if(heap[i] != 'p'){
+      printf(1, "forkbench: child write leaked into parent\n");
+      exit();
+    }
+  }
+
+  timeit("forkbench", 0, N, "fork/exit/wait", forkexit, 0);
+  timeit("forkbench", 0, N, "fork/exec/wait", forkexec, 0);
+
+  sbrk(-HEAP);
+  printf(1, "forkbench ok\n");
+}
+
+// nworkers procs each repeatedly grow and touch a heap, shrink
+// it again and fork, all of which hammer the page allocator.
+// Ticks should stay about flat as workers are added, up to the
+// number of CPUs.
+#define KBHEAP (64*1024)
+
+static void
+kbgrow(void *arg, int w, int i)
+{
+  char *heap;
+  int pid;
+
+  heap = sbrk(KBHEAP);
+  if(heap == (char*)-1){
+    printf(1, "kallocbench: sbrk failed\n");
+    exit();
+  }
+  memset(heap, i, KBHEAP);
+  if((pid = fork()) == 0)
+    exit();
+  if(pid > 0)
+    wait();
+  sbrk(-KBHEAP);
+}
+
+void
+kallocbench(void)
+{
+  static int nworkers[] = { 1, 2, 4, 8 };
+  int i;
+
+  printf(1, "kallocbench test\n");
+  for(i = 0; i < sizeof(nworkers)/sizeof(nworkers[0]); i++)
+    timeit("kallocbench", nworkers[i], 50, "grow/fork/shrink", kbgrow, 0);
+  printf(1, "kallocbench ok\n");
+}
+
+// exit/wait throughput for children with a touched 1MB heap,
+// so that exit frees a few hundred pages each.
+#define EBHEAP (1024*1024)
+
+static void
+bigexit(void *arg, int w, int i)
+{
+  char *heap;
+  int pid;
+
+  pid = fork();
+  if(pid < 0){
+    printf(1, "exitbench: fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    heap = sbrk(EBHEAP);
+    if(heap == (char*)-1){
+      printf(1, "exitbench: sbrk failed\n");
+      exit();
+    }
+    memset(heap, 1, EBHEAP);
+    exit();
+  }
+  wait();
+}
+
+void
+exitbench(void)
+{
+  printf(1, "exitbench test\n");
+  timeit("exitbench", 0, 50, "exit/wait of 1MB procs", bigexit, 0);
+  printf(1, "exitbench ok\n");
+}
+
+// nworkers procs each re-read their own small file, which stays
+// in the buffer cache; lookups of different blocks should not
+// serialize, so ticks should stay about flat as workers are added.
+#define RBSZ 1024
+
+static void
+rbread(void *arg, int w, int i)
+{
+  static char data[RBSZ];
+  char name[] = "rb0";
+  int fd;
+
+  name[2] = '0' + w;
+  if((fd = open(name, O_RDONLY)) < 0 || read(fd, data, RBSZ) != RBSZ){
+    printf(1, "breadbench: read %s failed\n", name);
+    exit();
+  }
+  close(fd);
+}
+
+void
+breadbench(void)
+{
+  static int nworkers[] = { 1, 2, 4 };
+  char name[] = "rb0";
+  char data[RBSZ];
+  struct bcachestat st;
+  int i, j, fd;
+
+  printf(1, "breadbench test\n");
+  memset(data, 'r', RBSZ);
+  for(j = 0; j < 4; j++){
+    name[2] = '0' + j;
+    fd = open(name, O_CREATE | O_RDWR);
+    if(fd < 0 || write(fd, data, RBSZ) != RBSZ){
+      printf(1, "breadbench: create %s failed\n", name);
+      exit();
+    }
+    close(fd);
+  }
+
+  for(i = 0; i < sizeof(nworkers)/sizeof(nworkers[0]); i++)
+    timeit("breadbench", nworkers[i], 300, "open/read/close", rbread, 0);
+
+  for(j = 0; j < 4; j++){
+    name[2] = '0' + j;
+    unlink(name);
+  }
+  if(bcachestat(&st) < 0){
+    printf(1, "breadbench: bcachestat failed\n");
+    exit();
+  }
+  printf(1, "breadbench: cache has %d bufs, %d hits, %d misses\n",
+         st.nbuf, st.hits, st.misses);
+  printf(1, "breadbench ok\n");
+}
+
+// Print a streambench rate; ticks come about 100 per second.
+void
+rate(char *what, int bytes, int t)
+{
+  int kb;
+
+  if(t == 0)
+    t = 1;
+  kb = bytes / 1024 * 100 / t;
+  printf(1, "streambench: %s %d bytes in %d ticks, %d.%d MB/s\n",
+         what, bytes, t, kb / 1024, kb % 1024 * 10 / 1024);
+}
+
+// Stream files through read() in cat-sized chunks.  The first
+// pass reads a file from the disk image, which is only cold if
+// nothing has touched it since boot, so run this benchmark first;
+// that is where sequential read-ahead matters.  Then write and
+// re-read a BIGFILE-byte file.
+void
+streambench(void)
+{
+  enum { SZ = 512, NPASS = 8 };
+  static char data[SZ];
+  struct bcachestat st0, st;
+  int i, n, fd, tot, start;
+
+  printf(1, "streambench test\n");
+  if(bcachestat(&st0) < 0){
+    printf(1, "streambench: bcachestat failed\n");
+    exit();
+  }
+
+  if((fd = open("usertests", O_RDONLY)) < 0){
+    printf(1, "streambench: open usertests failed\n");
+    exit();
+  }
+  start = uptime();
+  tot = 0;
+  while((n = read(fd, data, SZ)) > 0)
+    tot += n;
+  close(fd);
+  rate("cold read", tot, uptime() - start);
+
+  unlink("stream");
+  if((fd = open("stream", O_CREATE | O_RDWR)) < 0){
+    printf(1, "streambench: create stream failed\n");
+    exit();
+  }
+  start = uptime();
+  for(i = 0; i < BIGFILE/SZ; i++){
+    memset(data, i, SZ);
+    if(write(fd, data, SZ) != SZ){
+      printf(1, "streambench: write stream failed\n");
+      exit();
+    }
+  }
+  close(fd);
+  rate("write", BIGFILE, uptime() - start);
+
+  start = uptime();
+  tot = 0;
+  for(n = 0; n < NPASS; n++){
+    if((fd = open("stream", O_RDONLY)) < 0){
+      printf(1, "streambench: open stream failed\n");
+      exit();
+    }
+    for(i = 0; read(fd, data, SZ) == SZ; i++){
+      if(data[0] != (char)i || data[SZ-1] != (char)i){
+        printf(1, "streambench: read stream wrong data\n");
+        exit();
+      }
+      tot += SZ;
+    }
+    close(fd);
+  }
+  rate("cached read", tot, uptime() - start);
+  if(tot != NPASS*BIGFILE){
+    printf(1, "streambench: read stream wrong total\n");
+    exit();
+  }
+  unlink("stream");
+
+  if(bcachestat(&st) < 0){
+    printf(1, "streambench: bcachestat failed\n");
+    exit();
+  }
+  printf(1, "streambench: %d blocks read ahead\n", st.ahead - st0.ahead);
+  printf(1, "streambench ok\n");
+}
+
+// Write and read back a large file in big chunks, and report
+// how many block requests the disk driver merged into each
+// command; log writes and read-ahead should give runs of
+// adjacent blocks.
+#define DBSZ 8192
+
+static void
+dbwrite(void *arg, int w, int i)
+{
+  static char data[DBSZ];
+  int fd = *(int*)arg;
+
+  memset(data, i, DBSZ);
+  if(write(fd, data, DBSZ) != DBSZ){
+    printf(1, "diskbench: write disk failed\n");
+    exit();
+  }
+}
+
+void
+diskbench(void)
+{
+  enum { SZ = DBSZ, N = BIGFILE/SZ };
+  static char data[SZ];
+  struct diskstat st0, st;
+  int i, fd;
+
+  printf(1, "diskbench test\n");
+  if(diskstat(&st0) < 0){
+    printf(1, "diskbench: diskstat failed\n");
+    exit();
+  }
+  unlink("disk");
+  if((fd = open("disk", O_CREATE | O_RDWR)) < 0){
+    printf(1, "diskbench: create disk failed\n");
+    exit();
+  }
+  i = timeit("diskbench", 0, N, "8KB writes", dbwrite, &fd);
+  close(fd);
+  printf(1, "diskbench: %d KB/s\n", N*SZ / 1024 * 100 / (i ? i : 1));
+  if((fd = open("disk", O_RDONLY)) < 0){
+    printf(1, "diskbench: open disk failed\n");
+    exit();
+  }
+  for(i = 0; i < N; i++){
+    if(read(fd, data, SZ) != SZ || data[0] != (char)i || data[SZ-1] != (char)i){
+      printf(1, "diskbench: read disk wrong data\n");
+      exit();
+    }
+  }
+  close(fd);
+  unlink("disk");
+
+  if(diskstat(&st) < 0){
+    printf(1, "diskbench: diskstat failed\n");
+    exit();
+  }
+  st.nreq -= st0.nreq;
+  st.ncmd -= st0.ncmd;
+  printf(1, "diskbench: %d disk requests in %d commands, %d per 10 commands\n",
+         st.nreq, st.ncmd, st.ncmd ? st.nreq * 10 / st.ncmd : 0);
+  printf(1, "diskbench ok\n");
+}
+
+// Like usertests' createdelete: nworkers procs each create,
+// write and unlink their own files.  With group commit, the
+// system calls of concurrent writers share transactions, so the
+// total should grow less than linearly with the number of writers.
+static void
+cdfile(void *arg, int w, int i)
+{
+  char name[3];
+  int fd;
+
+  name[0] = 'c' + w;
+  name[1] = '0' + i;
+  name[2] = '\0';
+  if((fd = open(name, O_CREATE | O_RDWR)) < 0 ||
+     write(fd, name, sizeof(name)) != sizeof(name)){
+    printf(1, "commitbench: create %s failed\n", name);
+    exit();
+  }
+  close(fd);
+  if(unlink(name) < 0){
+    printf(1, "commitbench: unlink %s failed\n", name);
+    exit();
+  }
+}
+
+void
+commitbench(void)
+{
+  static int nworkers[] = { 1, 2, 4 };
+  int i;
+
+  printf(1, "commitbench test\n");
+  for(i = 0; i < sizeof(nworkers)/sizeof(nworkers[0]); i++)
+    timeit("commitbench", nworkers[i], 20, "create/write/unlink", cdfile, 0);
+  printf(1, "commitbench ok\n");
+}
+
+// Like usertests' bigwrite, but timed, and with single write()s
+// up to BIGFILE bytes.  filewrite() splits each write into
+// transactions of up to half a log region, so a bigger log
+// (make LOGBLOCKS=n) means fewer commits per write.
+static void
+bigwrite(void *arg, int w, int i)
+{
+  static char data[BIGFILE];
+  int sz = *(int*)arg;
+  int fd;
+
+  if((fd = open("bigwrite", O_CREATE | O_RDWR)) < 0){
+    printf(1, "bigwritebench: create bigwrite failed\n");
+    exit();
+  }
+  if(write(fd, data, sz) != sz){
+    printf(1, "bigwritebench: write(%d) failed\n", sz);
+    exit();
+  }
+  close(fd);
+  unlink("bigwrite");
+}
+
+void
+bigwritebench(void)
+{
+  int sz;
+
+  printf(1, "bigwritebench test\n");
+  for(sz = 4*BSIZE; sz <= BIGFILE; sz *= 2){
+    printf(1, "bigwritebench: %d bytes\n", sz);
+    timeit("bigwritebench", 0, 4, "writes", bigwrite, &sz);
+  }
+  printf(1, "bigwritebench ok\n");
+}
+
+// Like usertests' createtest, but with thousands of files, CBNPER
+// to a directory so that directory scans stay short.  Each round
+// should take about as long as the first however many inodes are
+// already in use, since ialloc() no longer searches from inode 1.
+#define CBNDIR 8
+#define CBNPER 256
+
+// Set name, "cba/aa" or like it, to file j of directory d.
+static void
+cbset(char *name, int d, int j)
+{
+  name[2] = 'a' + d;
+  name[4] = 'a' + j/16;
+  name[5] = 'a' + j%16;
+}
+
+static void
+cbcreate(void *arg, int w, int j)
+{
+  char name[] = "cba/aa";
+  int fd;
+
+  cbset(name, *(int*)arg, j);
+  if((fd = open(name, O_CREATE | O_RDWR)) < 0){
+    printf(1, "createbench: create %s failed\n", name);
+    exit();
+  }
+  close(fd);
+}
+
+static void
+cbunlink(void *arg, int w, int i)
+{
+  char name[] = "cba/aa";
+
+  cbset(name, i / CBNPER, i % CBNPER);
+  if(unlink(name) < 0){
+    printf(1, "createbench: unlink %s failed\n", name);
+    exit();
+  }
+  if(i % CBNPER == CBNPER - 1){
+    name[3] = '\0';
+    if(unlink(name) < 0){
+      printf(1, "createbench: unlink %s failed\n", name);
+      exit();
+    }
+  }
+}
+
+void
+createbench(void)
+{
+  char name[] = "cba";
+  int d;
+
+  printf(1, "createbench test\n");
+  for(d = 0; d < CBNDIR; d++){
+    name[2] = 'a' + d;
+    if(mkdir(name) < 0){
+      printf(1, "createbench: mkdir %s failed\n", name);
+      exit();
+    }
+    timeit("createbench", 0, CBNPER, "creates", cbcreate, &d);
+  }
+  timeit("createbench", 0, CBNDIR*CBNPER, "unlinks", cbunlink, 0);
+  printf(1, "createbench ok\n");
+}
+
+// Open the same names over and over, as sh does when it
+// exec's the same programs, and a name that does not exist.
+// Once the dcache and icache hold them, the lookups should
+// not touch the buffer cache at all.
+struct nbname {
+  char *name;
+  int exists;
+};
+
+static void
+nbopen(void *arg, int w, int i)
+{
+  struct nbname *nb = arg;
+  int fd;
+
+  if((fd = open(nb->name, O_RDONLY)) >= 0)
+    close(fd);
+  if((fd >= 0) != nb->exists){
+    printf(1, "namebench: open %s wrong\n", nb->name);
+    exit();
+  }
+}
+
+void
+namebench(void)
+{
+  static struct nbname names[] = {
+    { "perftests", 1 },
+    { "nosuchfile", 0 },
+  };
+  struct bcachestat st0, st;
+  int i;
+
+  printf(1, "namebench test\n");
+  for(i = 0; i < sizeof(names)/sizeof(names[0]); i++){
+    nbopen(&names[i], 0, 0);  // warm the caches
+    if(bcachestat(&st0) < 0){
+      printf(1, "namebench: bcachestat failed\n");
+      exit();
+    }
+    timeit("namebench", 0, 1000, names[i].name, nbopen, &names[i]);
+    if(bcachestat(&st) < 0){
+      printf(1, "namebench: bcachestat failed\n");
+      exit();
+    }
+    printf(1, "namebench: %d breads\n",
+           (st.hits + st.misses) - (st0.hits + st0.misses));
+  }
+  printf(1, "namebench ok\n");
+}
+
+// Like usertests' bigdir, but timed, with thousands of entries
+// in one directory.  Creating a name has to scan the whole
+// directory to make sure the name is new, so each round of BDNPER
+// takes longer than the last; the slope is what scanning a block
+// at a time keeps small.  Then look up names that are not there,
+// each a different one so that the dcache cannot answer.
+#define BDNROUND 8
+#define BDNPER 256
+
+// Set name, "bd/aaa" or like it, to entry j; upper case
+// names are never created.
+static void
+bdset(char *name, int j, int upper)
+{
+  name[3] = (upper ? 'A' : 'a') + j/256;
+  name[4] = 'a' + j/16%16;
+  name[5] = 'a' + j%16;
+}
+
+static void
+bdcreate(void *arg, int w, int j)
+{
+  char name[] = "bd/aaa";
+  int fd;
+
+  bdset(name, *(int*)arg * BDNPER + j, 0);
+  if((fd = open(name, O_CREATE | O_RDWR)) < 0){
+    printf(1, "bigdirbench: create %s failed\n", name);
+    exit();
+  }
+  close(fd);
+}
+
+static void
+bdmiss(void *arg, int w, int j)
+{
+  char name[] = "bd/aaa";
+
+  bdset(name, j, 1);
+  if(open(name, O_RDONLY) >= 0){
+    printf(1, "bigdirbench: open %s succeeded\n", name);
+    exit();
+  }
+}
+
+static void
+bdunlink(void *arg, int w, int j)
+{
+  char name[] = "bd/aaa";
+
+  bdset(name, j, 0);
+  if(unlink(name) < 0){
+    printf(1, "bigdirbench: unlink %s failed\n", name);
+    exit();
+  }
+}
+
+void
+bigdirbench(void)
+{
+  int round;
+
+  printf(1, "bigdirbench test\n");
+  if(mkdir("bd") < 0){
+    printf(1, "bigdirbench: mkdir bd failed\n");
+    exit();
+  }
+  for(round = 0; round < BDNROUND; round++)
+    timeit("bigdirbench", 0, BDNPER, "creates", bdcreate, &round);
+  timeit("bigdirbench", 0, BDNPER, "failed lookups", bdmiss, 0);
+  timeit("bigdirbench", 0, BDNROUND*BDNPER, "unlinks", bdunlink, 0);
+  if(unlink("bd") < 0){
+    printf(1, "bigdirbench: unlink bd failed\n");
+    exit();
+  }
+  printf(1, "bigdirbench ok\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  printf(1, "perftests starting\n");
+
+  streambench();
+  wakeupbench();
+  pingpongstress();
+  dispatchbench();
+  forkbench();
+  kallocbench();
+  exitbench();
+  breadbench();
+  diskbench();
+  commitbench();
+  bigwritebench();
+  createbench();
+  namebench();
+  bigdirbench();
+
+  exit();
+}
@@ -4,8 +4,10 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "x86.h"
+#include "traps.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "pstat.h"
 
 #define DEBUG 0
 #define CHECK_BIT(var,pos) ((var) & (1<<(pos)))
@@ -17,6 +19,40 @@ struct {
   struct proc proc[NPROC];
 } ptable;
 
+// Per-CPU run queues, one per priority level. A RUNNABLE proc sits
+// in exactly one slot of exactly one queue; slots are claimed and
+// emptied with cas, so no lock is needed. Each queue has NPROC slots
+// so an enqueue always finds room. head/tail are only hints that keep
+// the order roughly FIFO; count lets an idle CPU skip empty queues
+// when stealing. SCHED_RR only uses level 0.
+struct runq {
+  struct proc *slot[NPROC];
+  uint head;                   // Next slot to try in runqget()
+  uint tail;                   // Next slot to try in runqput()
+  int count;                   // Approximate number of queued procs
+} __attribute__((aligned(64)));
+
+static struct runq runqs[NCPU][NPRIO];
+
+#if SCHEDPOLICY == SCHED_MLFQ
+#define NLEVEL NPRIO
+#else
+#define NLEVEL 1
+#endif
+
+static uint boostgen;          // Bumped every BOOSTTICKS by schedboost()
+
+// Sleeping procs hashed by wait channel, so wakeup() only
+// looks at the procs that might be sleeping on its chan.
+#define NSLEEPQ 61
+
+struct sleepq {
+  struct spinlock lock;
+  struct proc *head;
+};
+
+static struct sleepq sleepqs[NSLEEPQ];
+
 static struct proc *initproc;
 
 int nextpid = 1;
@@ -24,11 +60,17 @@ extern void forkret(void);
 extern void trapret(void);
 
 static void wakeup1(void *chan);
+static void runqput(struct proc *p);
+static void runqkick(void);
 
 void
 pinit(void)
 {
+  struct sleepq *sq;
+
   initlock(&ptable.lock, "ptable");
+  for(sq = sleepqs; sq < &sleepqs[NSLEEPQ]; sq++)
+    initlock(&sq->lock, "sleepq");
 }
 
 // Must be called with interrupts disabled
@@ -70,6 +112,256 @@ myproc(void) {
   return p;
 }
 
+static void
+atomicadd(volatile int *addr, int n)
+{
+  int old = *addr;
+  while(!cas(addr, old, old+n))
+    old = *addr;
+}
+
+static void
+runqinsert(struct runq *q, struct proc *p)
+{
+  uint i;
+
+  for(i = q->tail; ; i++){
+    if(cas(&q->slot[i % NPROC], 0, (int)p))
+      break;
+  }
+  q->tail = i + 1;
+  atomicadd(&q->count, 1);
+}
+
+// A proc that has missed a priority boost starts over at level 0.
+static void
+catchboost(struct proc *p)
+{
+  if(p->boostgen != boostgen){
+    p->boostgen = boostgen;
+    p->prio = 0;
+    p->slice = 0;
+  }
+}
+
+// Put a RUNNABLE proc on the current CPU's run queue for its level.
+// Must be called with interrupts disabled.
+static void
+runqadd(struct proc *p)
+{
+  catchboost(p);
+  p->readyat = ticks;
+  runqinsert(&runqs[cpuid()][p->prio], p);
+}
+
+// Queue a proc that has just become RUNNABLE, and wake an idle
+// CPU to take it.  The scheduler re-queues the proc it just ran
+// with runqadd() instead, so that the proc stays on its warm
+// CPU unless another CPU runs dry on its own.
+static void
+runqput(struct proc *p)
+{
+  pushcli();
+  runqadd(p);
+  runqkick();
+  popcli();
+}
+
+// Wake one halted CPU, if any, so it can steal the proc
+// just queued. Must be called with interrupts disabled.
+static void
+runqkick(void)
+{
+  struct cpu *c, *me;
+
+  me = mycpu();
+  for(c = cpus; c < cpus+ncpu; c++){
+    if(c != me && c->idle && cas(&c->idle, 1, 0)){
+      lapicipi(c->apicid, T_IRQ0 + IRQ_WAKEUP);
+      return;
+    }
+  }
+}
+
+// Are all CPUs' run queues for level l empty?
+static int
+runqlevelempty(int l)
+{
+  int i;
+
+  for(i = 0; i < ncpu; i++)
+    if(runqs[i][l].count > 0)
+      return 0;
+  return 1;
+}
+
+// Are all run queues empty?
+static int
+runqempty(void)
+{
+  int l;
+
+  for(l = 0; l < NLEVEL; l++)
+    if(!runqlevelempty(l))
+      return 0;
+  return 1;
+}
+
+// Halt CPU c until runqkick() or a timer interrupt wakes it.
+// Advertising idle before the final check pairs with runqput()
+// queueing before looking at idle, so no wakeup is missed.
+static void
+idle(struct cpu *c)
+{
+  cli();
+  xchg(&c->idle, 1);
+  if(runqempty())
+    stihlt();
+  c->idle = 0;
+  sti();
+}
+
+// Take the oldest proc off q, or return 0 if it is empty.
+static struct proc*
+runqtake(struct runq *q)
+{
+  struct proc *p;
+  uint i, n;
+
+  if(q->count <= 0)
+    return 0;
+  for(n = 0, i = q->head; n < NPROC; n++, i++){
+    p = q->slot[i % NPROC];
+    if(p == 0 || !cas(&q->slot[i % NPROC], (int)p, 0))
+      continue;
+    q->head = i + 1;
+    atomicadd(&q->count, -1);
+    return p;
+  }
+  return 0;
+}
+
+// Pick the next proc for CPU c from the highest non-empty level:
+// its own queue first, then steal from the siblings, starting with
+// the next CPU to spread the load.
+// Must be called with interrupts disabled.
+static struct proc*
+runqget(struct cpu *c)
+{
+  struct proc *p;
+  int id, i, l;
+
+  id = c - cpus;
+  for(l = 0; l < NLEVEL; l++){
+    if((p = runqtake(&runqs[id][l])) != 0)
+      return p;
+    for(i = 1; i < ncpu; i++)
+      if((p = runqtake(&runqs[(id + i) % ncpu][l])) != 0)
+        return p;
+  }
+  return 0;
+}
+
+// After a priority boost, move CPU c's queued procs back to level 0.
+static void
+runqboost(struct cpu *c)
+{
+  struct proc *p;
+  int id, l;
+
+  if(c->boostgen == boostgen)
+    return;
+  c->boostgen = boostgen;
+  id = c - cpus;
+  for(l = 1; l < NLEVEL; l++){
+    while((p = runqtake(&runqs[id][l])) != 0){
+      catchboost(p);
+      runqinsert(&runqs[id][0], p);
+    }
+  }
+}
+
+// Called on every timer tick for the running proc.
+// Returns whether it should give up the CPU.
+int
+schedtick(void)
+{
+  struct proc *p = myproc();
+  int l;
+
+  if(SCHEDPOLICY != SCHED_MLFQ)
+    return 1;
+  if(++p->slice >= (1 << p->prio)){
+    // Used up its slice: drop a level.
+    p->slice = 0;
+    if(p->prio < NPRIO-1)
+      p->prio++;
+    return 1;
+  }
+  // Let a higher-priority proc in without waiting out the slice.
+  for(l = 0; l < p->prio; l++)
+    if(!runqlevelempty(l))
+      return 1;
+  return 0;
+}
+
+// Start a new MLFQ boost period. Called by the timer on CPU 0.
+void
+schedboost(void)
+{
+  if(SCHEDPOLICY == SCHED_MLFQ)
+    atomicadd((int*)&boostgen, 1);
+}
+static struct sleepq*
+chanhash(void *chan)
+{
+  return &sleepqs[((uint)chan >> 2) % NSLEEPQ];
+}
+
+// Record that p is about to sleep on chan.
+// p must not yet be NEG_SLEEPING, since wakeup1() spins on
+// NEG_SLEEPING procs while holding the bucket lock.
+static void
+chanlink(struct proc *p, void *chan)
+{
+  struct sleepq *sq = chanhash(chan);
+
+  acquire(&sq->lock);
+  p->chan = chan;
+  p->wakeup = 0;
+  p->cnext = sq->head;
+  sq->head = p;
+  release(&sq->lock);
+}
+
+static void
+chanremove(struct sleepq *sq, struct proc *p)
+{
+  struct proc **pp;
+
+  for(pp = &sq->head; *pp; pp = &(*pp)->cnext){
+    if(*pp == p){
+      *pp = p->cnext;
+      p->cnext = 0;
+      return;
+    }
+  }
+}
+
+// Take p off its sleep bucket if it is still on one.
+static void
+chanunlink(struct proc *p)
+{
+  struct sleepq *sq;
+
+  if(p->chan == 0)
+    return;
+  sq = chanhash(p->chan);
+  acquire(&sq->lock);
+  chanremove(sq, p);
+  p->chan = 0;
+  release(&sq->lock);
+}
 
 int
 allocpid(void)
@@ -137,6 +429,15 @@ allocproc(void)
   p->pendingSignals = 0;
   p->signalMask = 0;
 
+  p->prio = 0;
+  p->slice = 0;
+  p->boostgen = boostgen;
+  p->rticks = 0;
+  p->wticks = 0;
+  p->nswitch = 0;
+  p->nsleep = 0;
+  p->nsyscall = 0;
+
   return p;
 }
 
@@ -168,10 +469,13 @@ userinit(void)
   p->cwd = namei("/");
 
   p->state = RUNNABLE;
+  runqput(p);
 }
 
 
 // Grow current process's memory by n bytes.
+// Growing only moves sz; lazyfault() allocates each page
+// the first time it is touched.
 // Return 0 on success, -1 on failure.
 int
 growproc(int n)
@@ -181,8 +485,9 @@ growproc(int n)
 
   sz = curproc->sz;
   if(n > 0){
-    if((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0)
+    if(sz + n >= KERNBASE || sz + n < sz)
       return -1;
+    sz += n;
   } else if(n < 0) {
     if((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0)
       return -1;
@@ -242,7 +547,8 @@ fork(void)
   //acquire(&ptable.lock);
 
   //np->state = RUNNABLE;
-  cas(&np->state, EMBRYO, RUNNABLE);
+  if(cas(&np->state, EMBRYO, RUNNABLE))
+    runqput(np);
 
   return pid;
 }
@@ -306,11 +612,11 @@ wait(void)
   
   pushcli();//acquire(&ptable.lock);
   for(;;){
+    chanlink(curproc, curproc);
     if (!cas(&curproc->state, RUNNING, NEG_SLEEPING)) {
       panic("scheduler: cas failed");
     }
 
-    curproc->chan = curproc;    
     // Scan through table looking for zombie children.
     havekids = 0;
     for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
@@ -328,8 +634,8 @@ wait(void)
         freevm(p->pgdir);
         p->killed = 0;
         //freeproc(p);
-        curproc->chan = 0;
         cas(&curproc->state, NEG_SLEEPING, RUNNING);
+        chanunlink(curproc);
         // release(&ptable.lock);
         //cas(&p->state, NEG_UNUSED, UNUSED);
         popcli();
@@ -339,9 +645,8 @@ wait(void)
   
     // No point waiting if we don't have any children.
     if(!havekids || curproc->killed){
-      curproc->chan = 0;
-
       cas(&curproc->state, NEG_SLEEPING, RUNNING);
+      chanunlink(curproc);
       popcli();
       return -1;
     }
@@ -349,6 +654,7 @@ wait(void)
 
     // Wait for children to exit.  (See wakeup1 call in proc_exit.)
     //sleep(curproc, &ptable.lock);  //DOC: wait-sleep
+    curproc->nsleep++;
     sched();
   }
 }
@@ -387,20 +693,17 @@ scheduler(void)
     // Enable interrupts on this processor.
     sti();
 
-    // Loop over process table looking for process to run.
-
-    
+    // Take the next process off this CPU's run queue.
     pushcli(); //acquire(&ptable.lock);
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
-      if(!cas(&p->state, RUNNABLE, RUNNING))
-        continue;
-      
+    runqboost(c);
+    if((p = runqget(c)) != 0 && cas(&p->state, RUNNABLE, RUNNING)) {
       // Switch to chosen process.  It is the process's job
       // to release ptable.lock and then reacquire it
       // before jumping back to us.
       c->proc = p;
+      p->wticks += ticks - p->readyat;
+      p->nswitch++;
       switchuvm(p);
-      //p->state = RUNNING;
 
       swtch(&(c->scheduler), (c->proc)->context);
       switchkvm();
@@ -409,29 +712,23 @@ scheduler(void)
       // It should have changed its p->state before coming back.
       c->proc = 0;
       if(cas(&p->state, NEG_SLEEPING, SLEEPING)) {
-        if(cas(&p->killed, 1, 0))
-          p->state = RUNNABLE;
+        // A wakeup1() that found p still NEG_SLEEPING left
+        // the wakeup to us rather than spin.
+        if(cas(&p->wakeup, 1, 0))
+          cas(&p->state, SLEEPING, NEG_RUNNABLE);
+        else if(cas(&p->killed, 1, 0) && cas(&p->state, SLEEPING, NEG_RUNNABLE))
+          chanunlink(p);
       }
-      cas(&p->state, NEG_RUNNABLE, RUNNABLE);
-      //if(p->state == NEG_ZOMBIE) {
-       // freeproc(p);
+      if(cas(&p->state, NEG_RUNNABLE, RUNNABLE))
+        runqadd(p);
       if(cas(&p->state, NEG_ZOMBIE, ZOMBIE))
         wakeup1(p->parent);
-        /*
-          if (!p || p->state != NEG_ZOMBIE)
-            panic("freeproc not zombie");
-          kfree(p->kstack);
-          p->kstack = 0;
-          freevm(p->pgdir);
-          p->killed = 0;
-          p->chan = 0;
-       // freeproc(p);
-        if(cas(&p->state, NEG_ZOMBIE, ZOMBIE))
-          wakeup1(p->parent);*/
-      //}
     }
     popcli(); //release(&ptable.lock);
 
+    // Nothing to run: halt instead of spinning.
+    if(p == 0)
+      idle(c);
   }
 }
 
@@ -490,8 +787,8 @@ forkret(void)
     // be run from main().
     first = 0;
     
+    initlog(ROOTDEV);  // recover before iinit() reads the bitmap
     iinit(ROOTDEV);
-    initlog(ROOTDEV);
   }
 
   // Return to "caller", actually trapret (see allocproc).
@@ -510,7 +807,8 @@ sleep(void *chan, struct spinlock *lk)
   if(lk == 0)
     panic("sleep without lk");
   pushcli();
-  p->chan = chan;
+  p->nsleep++;
+  chanlink(p, chan);
 
   cas(&p->state, RUNNING, NEG_SLEEPING);
 
@@ -542,24 +840,35 @@ sleep(void *chan, struct spinlock *lk)
 
 //PAGEBREAK!
 // Wake up all processes sleeping on chan.
-// The ptable lock must be held.
+// Must be called with interrupts disabled.
 static void
 wakeup1(void *chan)
 {
-  struct proc *p;
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
-    if(p->chan == chan && (p->state == SLEEPING || p->state == NEG_SLEEPING)) {
-      while(p->state == NEG_SLEEPING) {
-        // busy-wait
-      }
-      if(cas(&p->state, SLEEPING, NEG_RUNNABLE)) {
-        p->chan = 0;
-        cas(&p->state, NEG_RUNNABLE, RUNNABLE);
+  struct sleepq *sq = chanhash(chan);
+  struct proc *p, *next;
 
-      }
+  acquire(&sq->lock);
+  for(p = sq->head; p; p = next) {
+    next = p->cnext;
+    if(p->chan != chan || (p->state != SLEEPING && p->state != NEG_SLEEPING))
+      continue;
+    chanremove(sq, p);
+    p->chan = 0;
+    if(!cas(&p->state, SLEEPING, NEG_RUNNABLE)) {
+      // p has not reached the scheduler yet. Leave a pending
+      // wakeup for the scheduler to act on. If p became SLEEPING
+      // before the scheduler could see the flag, whoever clears
+      // the flag first does the wakeup.
+      mycpu()->handoffs++;
+      cas(&p->wakeup, 0, 1);
+      if(p->state == NEG_SLEEPING || !cas(&p->wakeup, 1, 0) ||
+         !cas(&p->state, SLEEPING, NEG_RUNNABLE))
+        continue;
     }
+    if(cas(&p->state, NEG_RUNNABLE, RUNNABLE))
+      runqput(p);
   }
-
+  release(&sq->lock);
 }
 
 // Wake up all processes sleeping on chan.
@@ -592,6 +901,19 @@ kill(int pid, int signum)
   return -1;
 }
 
+static char *states[] = {
+[UNUSED]    "unused",
+[NEG_UNUSED] "neg_unused",
+[EMBRYO]    "embryo",
+[SLEEPING]  "sleep ",
+[NEG_SLEEPING]  "neg_sleep ",
+[RUNNABLE]  "runnable",
+[NEG_RUNNABLE]  "neg_runnable",
+[RUNNING]   "running",
+[ZOMBIE]    "zombie",
+[NEG_ZOMBIE]    "neg_zombie"
+};
+
 //PAGEBREAK: 36
 // Print a process listing to console.  For debugging.
 // Runs when user types ^P on console.
@@ -599,18 +921,6 @@ kill(int pid, int signum)
 void
 procdump(void)
 {
-  static char *states[] = {
-  [UNUSED]    "unused",
-  [NEG_UNUSED] "neg_unused",
-  [EMBRYO]    "embryo",
-  [SLEEPING]  "sleep ",
-  [NEG_SLEEPING]  "neg_sleep ",
-  [RUNNABLE]  "runnable",
-  [NEG_RUNNABLE]  "neg_runnable",
-  [RUNNING]   "running",
-  [ZOMBIE]    "zombie",
-  [NEG_ZOMBIE]    "neg_zombie"
-  };
   int i;
   struct proc *p;
   char *state;
@@ -633,6 +943,51 @@ procdump(void)
   }
 }
 
+// Copy statistics for up to n live procs into ps.
+// Returns the number filled in.  Like procdump, takes no lock,
+// so the numbers are a snapshot that may be slightly stale.
+int
+getprocstats(struct procstat *ps, int n)
+{
+  struct proc *p;
+  int k;
+
+  k = 0;
+  for(p = ptable.proc; p < &ptable.proc[NPROC] && k < n; p++){
+    if(p->state == UNUSED)
+      continue;
+    ps[k].pid = p->pid;
+    ps[k].ppid = p->parent ? p->parent->pid : 0;
+    if(p->state >= 0 && p->state < NELEM(states) && states[p->state])
+      safestrcpy(ps[k].state, states[p->state], sizeof(ps[k].state));
+    else
+      safestrcpy(ps[k].state, "???", sizeof(ps[k].state));
+    safestrcpy(ps[k].name, p->name, sizeof(ps[k].name));
+    ps[k].rticks = p->rticks;
+    ps[k].wticks = p->wticks;
+    if(p->state == RUNNABLE)
+      ps[k].wticks += ticks - p->readyat;
+    ps[k].nswitch = p->nswitch;
+    ps[k].nsleep = p->nsleep;
+    ps[k].nsyscall = p->nsyscall;
+    k++;
+  }
+  return k;
+}
+
+// Fill cs with the counters of up to n CPUs; returns the count.
+int
+getcpustats(struct cpustat *cs, int n)
+{
+  int i;
+
+  for(i = 0; i < ncpu && i < n; i++){
+    cs[i].idleticks = cpus[i].idleticks;
+    cs[i].handoffs = cpus[i].handoffs;
+  }
+  return i;
+}
+
 uint
 sigprocmask(uint mask) {
   struct proc *p = myproc();
@@ -654,7 +1009,10 @@ sigkill(void) {
   struct proc *p = myproc();
   //cprintf("SIGKILL!\n");
   p->killed = 1;
-  cas(&p->state, SLEEPING, RUNNABLE);
+  if(cas(&p->state, SLEEPING, RUNNABLE)){
+    chanunlink(p);
+    runqput(p);
+  }
   //p->pendingSignals &= ~(1UL << SIGKILL);
 }
 
@@ -8,6 +8,10 @@ struct cpu {
   int ncli;                    // Depth of pushcli nesting.
   int intena;                  // Were interrupts enabled before pushcli?
   struct proc *proc;           // The process running on this cpu or null
+  volatile uint idle;          // Halted in scheduler() waiting for work
+  uint idleticks;              // Timer ticks taken while halted
+  uint handoffs;               // Early wakeups left to the scheduler
+  uint boostgen;               // Last MLFQ boost applied to this CPU's queues
 };
 
 extern struct cpu cpus[NCPU];
@@ -87,6 +91,17 @@ struct proc {
   struct trapframe *tf;        // Trap frame for current syscall
   struct context *context;     // swtch() here to run process
   void *chan;                  // If non-zero, sleeping on chan
+  struct proc *cnext;          // Next proc in chan's sleep bucket
+  int wakeup;                  // Woken while NEG_SLEEPING; scheduler finishes it
+  int prio;                    // MLFQ level, 0 is highest
+  int slice;                   // Ticks used at the current level
+  uint boostgen;               // Last priority boost this proc has seen
+  uint readyat;                // Tick at which it last became RUNNABLE
+  uint rticks;                 // Ticks spent running
+  uint wticks;                 // Ticks spent runnable, waiting for a CPU
+  uint nswitch;                // Times switched onto a CPU
+  uint nsleep;                 // Voluntary sleeps
+  uint nsyscall;               // System calls made
   int killed;                  // If non-zero, have been killed
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
@@ -0,0 +1,61 @@
+// List processes with their CPU accounting.
+// "ps" prints one listing; "ps n" acts like top, printing the
+// busiest procs first every n ticks until killed.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+#include "pstat.h"
+
+struct procstat ps[NPROC];
+
+void
+sortbyrun(int n)
+{
+  struct procstat t;
+  int i, j;
+
+  for(i = 1; i < n; i++){
+    t = ps[i];
+    for(j = i; j > 0 && ps[j-1].rticks < t.rticks; j--)
+      ps[j] = ps[j-1];
+    ps[j] = t;
+  }
+}
+
+void
+list(int n)
+{
+  int i;
+
+  printf(1, "pid\tppid\trun\twait\tswitch\tsleep\tsyscall\tstate\tname\n");
+  for(i = 0; i < n; i++)
+    printf(1, "%d\t%d\t%d\t%d\t%d\t%d\t%d\t%s\t%s\n",
+           ps[i].pid, ps[i].ppid, ps[i].rticks, ps[i].wticks,
+           ps[i].nswitch, ps[i].nsleep, ps[i].nsyscall,
+           ps[i].state, ps[i].name);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n, interval;
+
+  interval = argc > 1 ? atoi(argv[1]) : 0;
+  for(;;){
+    if((n = getprocstats(ps, NPROC)) < 0){
+      printf(2, "ps: getprocstats failed\n");
+      exit();
+    }
+    if(interval <= 0){
+      list(n);
+      break;
+    }
+    sortbyrun(n);
+    list(n);
+    printf(1, "\n");
+    sleep(interval);
+  }
+  exit();
+}
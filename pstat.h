@@ -0,0 +1,19 @@
+// Per-process statistics returned by getprocstats().
+struct procstat {
+  int pid;
+  int ppid;
+  char state[16];
+  char name[16];
+  uint rticks;     // Ticks spent running
+  uint wticks;     // Ticks spent runnable, waiting for a CPU
+  uint nswitch;    // Times switched onto a CPU
+  uint nsleep;     // Voluntary sleeps
+  uint nsyscall;   // System calls made
+};
+
+// Per-CPU statistics returned by getcpustats().
+struct cpustat {
+  uint idleticks;  // Timer ticks spent halted with nothing to run
+  uint handoffs;   // Wakeups of procs still on their way to sleep,
+                   // left to the scheduler rather than waited for
+};
@@ -0,0 +1,79 @@
+// Response time of an interactive proc competing with CPU hogs.
+// A pair of procs bounces a byte over pipes, pausing between
+// round trips like a shell waiting for keystrokes, while NHOG
+// children spin. Compare the numbers under SCHED_RR and SCHED_MLFQ.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+
+#define NHOG    8
+#define NROUND  50
+
+int
+main(int argc, char *argv[])
+{
+  int hogs[NHOG];
+  int ping[2], pong[2];
+  int i, pid, t0, t, total, worst;
+  char c;
+
+  printf(1, "schedbench: %d hogs, %d round trips\n", NHOG, NROUND);
+
+  for(i = 0; i < NHOG; i++){
+    hogs[i] = fork();
+    if(hogs[i] < 0){
+      printf(1, "schedbench: fork failed\n");
+      exit();
+    }
+    if(hogs[i] == 0)
+      for(;;)
+        ;
+  }
+
+  if(pipe(ping) != 0 || pipe(pong) != 0){
+    printf(1, "schedbench: pipe failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid < 0){
+    printf(1, "schedbench: fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    close(ping[1]);
+    close(pong[0]);
+    while(read(ping[0], &c, 1) == 1)
+      write(pong[1], &c, 1);
+    exit();
+  }
+  close(ping[0]);
+  close(pong[1]);
+
+  total = worst = 0;
+  for(i = 0; i < NROUND; i++){
+    sleep(2);
+    t0 = uptime();
+    write(ping[1], "x", 1);
+    if(read(pong[0], &c, 1) != 1){
+      printf(1, "schedbench: read failed\n");
+      exit();
+    }
+    t = uptime() - t0;
+    total += t;
+    if(t > worst)
+      worst = t;
+  }
+  close(ping[1]);
+  wait();
+
+  for(i = 0; i < NHOG; i++)
+    kill(hogs[i], SIGKILL);
+  for(i = 0; i < NHOG; i++)
+    wait();
+
+  printf(1, "schedbench: response total %d ticks, worst %d ticks\n",
+         total, worst);
+  exit();
+}
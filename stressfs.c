@@ -6,30 +6,38 @@
 // after about 5 runs of stressfs in QEMU on a 2.1GHz CPU:
 //    for (i = 0; i < 40000; i++)
 //      asm volatile("");
+//
+// At the end it prints the disk queue counters for the run, to
+// compare disk schedulers (make DISKSCHED=DISK_FIFO or DISK_SCAN).
 
 #include "types.h"
 #include "stat.h"
 #include "user.h"
 #include "fs.h"
 #include "fcntl.h"
+#include "dstat.h"
 
 int
 main(int argc, char *argv[])
 {
-  int fd, i;
+  int fd, i, me, start;
   char path[] = "stressfs0";
   char data[512];
+  struct diskstat st0, st;
 
   printf(1, "stressfs starting\n");
   memset(data, 'a', sizeof(data));
+  diskstat(&st0);
+  start = uptime();
 
   for(i = 0; i < 4; i++)
     if(fork() > 0)
       break;
 
-  printf(1, "write %d\n", i);
+  me = i;
+  printf(1, "write %d\n", me);
 
-  path[8] += i;
+  path[8] += me;
   fd = open(path, O_CREATE | O_RDWR);
   for(i = 0; i < 20; i++)
 //    printf(fd, "%d\n", i);
@@ -45,5 +53,20 @@ main(int argc, char *argv[])
 
   wait();
 
+  if(me == 0){
+    diskstat(&st);
+    st.nreq -= st0.nreq;
+    st.ncmd -= st0.ncmd;
+    st.nseek -= st0.nseek;
+    st.seekdist -= st0.seekdist;
+    st.depthsum -= st0.depthsum;
+    st.expired -= st0.expired;
+    printf(1, "stressfs: %d ticks, %d disk requests in %d commands\n",
+           uptime() - start, st.nreq, st.ncmd);
+    printf(1, "stressfs: %d seeks over %d blocks\n", st.nseek, st.seekdist);
+    printf(1, "stressfs: queue depth avg %d max %d, %d past deadline\n",
+           st.nreq ? st.depthsum / st.nreq : 0, st.maxdepth, st.expired);
+  }
+
   exit();
 }
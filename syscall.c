@@ -21,6 +21,8 @@ fetchint(uint addr, int *ip)
 
   if(addr >= curproc->sz || addr+4 > curproc->sz)
     return -1;
+  if(uvmtouch(curproc->pgdir, curproc->sz, addr, 4, 0) < 0)
+    return -1;
   *ip = *(int*)(addr);
   return 0;
 }
@@ -39,6 +41,9 @@ fetchstr(uint addr, char **pp)
   *pp = (char*)addr;
   ep = (char*)curproc->sz;
   for(s = *pp; s < ep; s++){
+    if((s == *pp || (uint)s % PGSIZE == 0) &&
+       uvmtouch(curproc->pgdir, curproc->sz, (uint)s, 1, 0) < 0)
+      return -1;
     if(*s == 0)
       return s - *pp;
   }
@@ -65,10 +70,24 @@ argptr(int n, char **pp, int size)
     return -1;
   if(size < 0 || (uint)i >= curproc->sz || (uint)i+size > curproc->sz)
     return -1;
+  if(uvmtouch(curproc->pgdir, curproc->sz, i, size, 0) < 0)
+    return -1;
   *pp = (char*)i;
   return 0;
 }
 
+// Like argptr, for a block of memory the system call will
+// write: copy-on-write pages in it are copied up front.
+int
+argwptr(int n, char **pp, int size)
+{
+  struct proc *curproc = myproc();
+
+  if(argptr(n, pp, size) < 0)
+    return -1;
+  return uvmtouch(curproc->pgdir, curproc->sz, (uint)*pp, size, 1);
+}
+
 // Fetch the nth word-sized system call argument as a string pointer.
 // Check that the pointer is valid and the string is nul-terminated.
 // (There is no shared writable memory, so the string can't change
@@ -106,6 +125,10 @@ extern int sys_uptime(void);
 extern int sys_sigprocmask(void);
 extern int sys_signal(void);
 extern int sys_sigret(void);
+extern int sys_getprocstats(void);
+extern int sys_bcachestat(void);
+extern int sys_diskstat(void);
+extern int sys_getcpustats(void);
 
 #define SYS_sigret  24
 
@@ -135,6 +158,10 @@ static int (*syscalls[])(void) = {
 [SYS_sigprocmask]   sys_sigprocmask,
 [SYS_signal]   sys_signal,
 [SYS_sigret]   sys_sigret,
+[SYS_getprocstats]   sys_getprocstats,
+[SYS_bcachestat]   sys_bcachestat,
+[SYS_diskstat]   sys_diskstat,
+[SYS_getcpustats]   sys_getcpustats,
 
 };
 
@@ -145,6 +172,7 @@ syscall(void)
   struct proc *curproc = myproc();
 
   num = curproc->tf->eax;
+  curproc->nsyscall++;
   if(num > 0 && num < NELEM(syscalls) && syscalls[num]) {
     curproc->tf->eax = syscalls[num]();
   } else {
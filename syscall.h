@@ -23,3 +23,7 @@
 #define SYS_sigprocmask  22
 #define SYS_signal  23
 #define SYS_sigret  24
+#define SYS_getprocstats 25
+#define SYS_bcachestat 26
+#define SYS_diskstat 27
+#define SYS_getcpustats 28
@@ -15,6 +15,8 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "bstat.h"
+#include "dstat.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -73,7 +75,7 @@ sys_read(void)
   int n;
   char *p;
 
-  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0)
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argwptr(1, &p, n) < 0)
     return -1;
   return fileread(f, p, n);
 }
@@ -109,7 +111,7 @@ sys_fstat(void)
   struct file *f;
   struct stat *st;
 
-  if(argfd(0, 0, &f) < 0 || argptr(1, (void*)&st, sizeof(*st)) < 0)
+  if(argfd(0, 0, &f) < 0 || argwptr(1, (void*)&st, sizeof(*st)) < 0)
     return -1;
   return filestat(f, st);
 }
@@ -218,6 +220,7 @@ sys_unlink(void)
   memset(&de, 0, sizeof(de));
   if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
     panic("unlink: writei");
+  dcremove(dp, name, off);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
@@ -420,6 +423,30 @@ sys_exec(void)
   return exec(path, argv);
 }
 
+// Copy the buffer cache counters to a user struct bcachestat.
+int
+sys_bcachestat(void)
+{
+  struct bcachestat *st;
+
+  if(argwptr(0, (void*)&st, sizeof(*st)) < 0)
+    return -1;
+  bstat(st);
+  return 0;
+}
+
+// Copy the disk queue counters to a user struct diskstat.
+int
+sys_diskstat(void)
+{
+  struct diskstat *st;
+
+  if(argwptr(0, (void*)&st, sizeof(*st)) < 0)
+    return -1;
+  idestat(st);
+  return 0;
+}
+
 int
 sys_pipe(void)
 {
@@ -427,7 +454,7 @@ sys_pipe(void)
   struct file *rf, *wf;
   int fd0, fd1;
 
-  if(argptr(0, (void*)&fd, 2*sizeof(fd[0])) < 0)
+  if(argwptr(0, (void*)&fd, 2*sizeof(fd[0])) < 0)
     return -1;
   if(pipealloc(&rf, &wf) < 0)
     return -1;
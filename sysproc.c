@@ -6,6 +6,7 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "pstat.h"
 
 int
 sys_fork(void)
@@ -113,6 +114,38 @@ sys_signal(void)
   return (int) signal(signum, handler);
 }
 
+// Fill a user array of struct procstat; returns the count.
+int
+sys_getprocstats(void)
+{
+  struct procstat *ps;
+  int n;
+
+  if(argint(1, &n) < 0 || n < 0)
+    return -1;
+  if(n > NPROC)
+    n = NPROC;
+  if(argwptr(0, (char**)&ps, n*sizeof(*ps)) < 0)
+    return -1;
+  return getprocstats(ps, n);
+}
+
+// Fill a user array of struct cpustat; returns the count.
+int
+sys_getcpustats(void)
+{
+  struct cpustat *cs;
+  int n;
+
+  if(argint(1, &n) < 0 || n < 0)
+    return -1;
+  if(n > NCPU)
+    n = NCPU;
+  if(argwptr(0, (char**)&cs, n*sizeof(*cs)) < 0)
+    return -1;
+  return getcpustats(cs, n);
+}
+
 int sys_sigret(void) 
 {
   sigret();
@@ -48,9 +48,15 @@ trap(struct trapframe *tf)
 
   switch(tf->trapno){
   case T_IRQ0 + IRQ_TIMER:
+    if(myproc() && myproc()->state == RUNNING)
+      myproc()->rticks++;
+    else if(mycpu()->idle)
+      mycpu()->idleticks++;
     if(cpuid() == 0){
       acquire(&tickslock);
       ticks++;
+      if(ticks % BOOSTTICKS == 0)
+        schedboost();
       wakeup(&ticks);
       release(&tickslock);
     }
@@ -67,6 +73,10 @@ trap(struct trapframe *tf)
     kbdintr();
     lapiceoi();
     break;
+  case T_IRQ0 + IRQ_WAKEUP:
+    // Only needed to bring an idle CPU out of hlt.
+    lapiceoi();
+    break;
   case T_IRQ0 + IRQ_COM1:
     uartintr();
     lapiceoi();
@@ -78,6 +88,16 @@ trap(struct trapframe *tf)
     lapiceoi();
     break;
 
+  case T_PGFLT:
+    // A write to a copy-on-write page, or the first touch of a
+    // lazily allocated heap page, from user space or from the
+    // kernel copying to or from user memory.
+    if(myproc() && ((tf->err & FEC_PR) ?
+       (tf->err & FEC_WR) && cowfault(myproc()->pgdir, rcr2()) == 0 :
+       lazyfault(myproc()->pgdir, myproc()->sz, rcr2()) == 0))
+      break;
+    // fall through
+
   //PAGEBREAK: 13
   default:
     if(myproc() == 0 || (tf->cs&3) == 0){
@@ -100,10 +120,11 @@ trap(struct trapframe *tf)
   if(myproc() && myproc()->killed && (tf->cs&3) == DPL_USER)
     exit();
 
-  // Force process to give up CPU on clock tick.
+  // Force process to give up CPU on clock tick once its time
+  // slice is used up (every tick for round robin).
   // If interrupts were on while locks held, would need to check nlock.
   if(myproc() && myproc()->state == RUNNING &&
-     tf->trapno == T_IRQ0+IRQ_TIMER)
+     tf->trapno == T_IRQ0+IRQ_TIMER && schedtick())
     yield();
 
   // Check if the process has been killed since we yielded
@@ -1,5 +1,9 @@
 struct stat;
 struct rtcdate;
+struct procstat;
+struct cpustat;
+struct bcachestat;
+struct diskstat;
 
 // system calls
 int fork(void);
@@ -26,6 +30,10 @@ int uptime(void);
 uint sigprocmask(uint);
 sighandler_t signal(int, sighandler_t);
 void sigret(void);
+int getprocstats(struct procstat*, int);
+int bcachestat(struct bcachestat*);
+int diskstat(struct diskstat*);
+int getcpustats(struct cpustat*, int);
 
 // ulib.c
 int stat(char*, struct stat*);
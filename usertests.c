@@ -7,6 +7,7 @@
 #include "syscall.h"
 #include "traps.h"
 #include "memlayout.h"
+#include "pstat.h"
 
 char buf[8192];
 char name[3];
@@ -424,6 +425,71 @@ exitwait(void)
   printf(1, "exitwait ok\n");
 }
 
+// getprocstats() should list a sleeping child with its pid,
+// parent and state, and refuse a buffer past the end of memory.
+void
+procstats(void)
+{
+  static struct procstat ps[NPROC];
+  int fds[2];
+  int i, n, pid, tries;
+  char c;
+
+  printf(1, "procstats test\n");
+  if(pipe(fds) != 0){
+    printf(1, "pipe() failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid < 0){
+    printf(1, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    close(fds[1]);
+    read(fds[0], &c, 1);
+    exit();
+  }
+  close(fds[0]);
+
+  // The child soon blocks reading the pipe.
+  for(tries = 0; tries < 100; tries++){
+    n = getprocstats(ps, NPROC);
+    if(n <= 0 || n > NPROC){
+      printf(1, "getprocstats returned %d\n", n);
+      exit();
+    }
+    for(i = 0; i < n; i++)
+      if(ps[i].pid == pid)
+        break;
+    if(i == n){
+      printf(1, "getprocstats did not list child %d\n", pid);
+      exit();
+    }
+    if(strcmp(ps[i].state, "sleep ") == 0)
+      break;
+    sleep(1);
+  }
+  if(tries == 100){
+    printf(1, "getprocstats: child %d never sleeping\n", pid);
+    exit();
+  }
+  if(ps[i].ppid != getpid()){
+    printf(1, "getprocstats: child %d has parent %d\n", pid, ps[i].ppid);
+    exit();
+  }
+
+  if(getprocstats((struct procstat*)sbrk(0), 1) != -1){
+    printf(1, "getprocstats accepted a bad buffer\n");
+    exit();
+  }
+
+  write(fds[1], "x", 1);
+  close(fds[1]);
+  wait();
+  printf(1, "procstats ok\n");
+}
+
 void
 mem(void)
 {
@@ -1347,8 +1413,7 @@ iref(void)
 
   printf(1, "empty file name\n");
 
-  // the 50 is NINODE
-  for(i = 0; i < 50 + 1; i++){
+  for(i = 0; i < NINODE + 1; i++){
     if(mkdir("irefd") != 0){
       printf(1, "mkdir irefd failed\n");
       exit();
@@ -1783,6 +1848,7 @@ main(int argc, char *argv[])
   pipe1();
   preempt();
   exitwait();
+  procstats();
 
   rmdot();
   fourteen();
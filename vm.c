@@ -311,7 +311,10 @@ clearpteu(pde_t *pgdir, char *uva)
 }
 
 // Given a parent process's page table, create a copy
-// of it for a child.
+// of it for a child.  Pages are shared rather than copied:
+// writable user pages become read-only PTE_COW in both page
+// tables, and cowfault() copies them on the first write.
+// pgdir must be the current page table.
 pde_t*
 copyuvm(pde_t *pgdir, uint sz)
 {
@@ -323,25 +326,118 @@ copyuvm(pde_t *pgdir, uint sz)
   if((d = setupkvm()) == 0)
     return 0;
   for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0)
-      panic("copyuvm: pte should exist");
-    if(!(*pte & PTE_P))
-      panic("copyuvm: page not present");
+    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0 || !(*pte & PTE_P))
+      continue;  // not touched yet; see lazyfault()
+    if((*pte & (PTE_W|PTE_U)) == PTE_W){
+      // Not a user page (the stack guard page): the kernel may
+      // write it without taking a fault, so the child gets its
+      // own copy now, as before copy-on-write.
+      if((mem = kalloc()) == 0)
+        goto bad;
+      memmove(mem, (char*)P2V(PTE_ADDR(*pte)), PGSIZE);
+      if(mappages(d, (void*)i, PGSIZE, V2P(mem), PTE_FLAGS(*pte)) < 0){
+        kfree(mem);
+        goto bad;
+      }
+      continue;
+    }
+    if(*pte & PTE_W)
+      *pte = (*pte & ~PTE_W) | PTE_COW;
     pa = PTE_ADDR(*pte);
     flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
-      goto bad;
-    memmove(mem, (char*)P2V(pa), PGSIZE);
-    if(mappages(d, (void*)i, PGSIZE, V2P(mem), flags) < 0)
+    if(mappages(d, (void*)i, PGSIZE, pa, flags) < 0)
       goto bad;
+    kref(P2V(pa));
   }
+  lcr3(V2P(pgdir));  // flush the parent's now read-only TLB entries
   return d;
 
 bad:
+  lcr3(V2P(pgdir));
   freevm(d);
   return 0;
 }
 
+// Handle a write fault at user address va in pgdir.
+// If the page is copy-on-write, give pgdir its own writable
+// copy (or just make it writable if nobody else shares it).
+// Returns 0 if the fault was handled, -1 if it is a real fault.
+int
+cowfault(pde_t *pgdir, uint va)
+{
+  pte_t *pte;
+  uint pa, flags;
+  char *mem;
+
+  if(va >= KERNBASE)
+    return -1;
+  pte = walkpgdir(pgdir, (char*)va, 0);
+  if(pte == 0 || (*pte & (PTE_P|PTE_U|PTE_COW)) != (PTE_P|PTE_U|PTE_COW))
+    return -1;
+  pa = PTE_ADDR(*pte);
+  flags = (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;
+  if(krefcount(P2V(pa)) == 1){
+    *pte = pa | flags;
+  } else {
+    if((mem = kalloc()) == 0)
+      return -1;
+    memmove(mem, (char*)P2V(pa), PGSIZE);
+    *pte = V2P(mem) | flags;
+    kfree(P2V(pa));
+  }
+  if(myproc() && pgdir == myproc()->pgdir)
+    lcr3(V2P(pgdir));
+  return 0;
+}
+
+// Handle a fault on a not-present user address va below sz:
+// a heap page that sbrk() reserved but nobody has touched yet.
+// Returns 0 if the fault was handled, -1 if it is a real fault.
+int
+lazyfault(pde_t *pgdir, uint sz, uint va)
+{
+  pte_t *pte;
+  char *mem;
+
+  if(va >= sz || va >= KERNBASE)
+    return -1;
+  va = PGROUNDDOWN(va);
+  if((pte = walkpgdir(pgdir, (char*)va, 0)) != 0 && (*pte & PTE_P))
+    return -1;
+  if((mem = kalloc()) == 0)
+    return -1;
+  memset(mem, 0, PGSIZE);
+  if(mappages(pgdir, (char*)va, PGSIZE, V2P(mem), PTE_W|PTE_U) < 0){
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
+// Make the user pages holding [va, va+n) present ahead of a
+// system call touching them, and if the call will write them,
+// copy any copy-on-write ones, so that running out of memory
+// fails the call instead of faulting inside the kernel.
+// pgdir must be the current page table.  Returns 0 or -1.
+int
+uvmtouch(pde_t *pgdir, uint sz, uint va, uint n, int write)
+{
+  pte_t *pte;
+  uint a;
+
+  for(a = PGROUNDDOWN(va); a < va + n; a += PGSIZE){
+    pte = walkpgdir(pgdir, (char*)a, 0);
+    if(pte == 0 || (*pte & PTE_P) == 0){
+      if(lazyfault(pgdir, sz, a) < 0)
+        return -1;
+    } else if(write && (*pte & PTE_COW)){
+      if(cowfault(pgdir, a) < 0)
+        return -1;
+    }
+  }
+  return 0;
+}
+
 //PAGEBREAK!
 // Map user virtual address to kernel address.
 char*
@@ -365,10 +461,14 @@ copyout(pde_t *pgdir, uint va, void *p, uint len)
 {
   char *buf, *pa0;
   uint n, va0;
+  pte_t *pte;
 
   buf = (char*)p;
   while(len > 0){
     va0 = (uint)PGROUNDDOWN(va);
+    if((pte = walkpgdir(pgdir, (char*)va0, 0)) != 0 && (*pte & PTE_COW) &&
+       cowfault(pgdir, va0) < 0)
+      return -1;
     pa0 = uva2ka(pgdir, (char*)va0);
     if(pa0 == 0)
       return -1;